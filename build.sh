@@ -1,3 +1,5 @@
 #! /bin/bash
 
-gcc -o pino pino.c
+# -rdynamic exports the runtime symbols that load-native plugins link against.
+# -pthread for the par-map worker pool.
+gcc -o pino pino.c -rdynamic -ldl -pthread
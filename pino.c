@@ -1,23 +1,44 @@
 // C implementation of a simple forth machine structure
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdalign.h>
+#include <dlfcn.h>
+#include <immintrin.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <elf.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+
+#include "pino.h"
 
 // Need this to determine which are atomic vs, non-atomic functions
 #pragma GCC optimize ("align-functions=16")
 
-typedef    void*(*fword)(void);
-
-fword* i_ptr = NULL;
+// Interpreter state that each par-map worker thread gets its own copy of
+// is __thread.  The enable flags below are too, so they stay off in
+// workers: tiering, profiling and perf counters only run on the main
+// thread.
+__thread fword* i_ptr = NULL;
 bool compile_mode = false;
 bool postpone_flag = false;
 int print_ds(char* str, int len);
 int print_rs(char* str, int len);
 void print_fn_impl (void* fp, const char* msg, const char* out, const char* fname);
+int out_printf (const char* fmt, ...);
+void out_write (const char* str, uint32_t len);
+void out_flush (void);
 
 #define get_shift()         3*(tors - BASE_OF_STACK)
 
@@ -34,12 +55,34 @@ void print_fn_impl (void* fp, const char* msg, const char* out, const char* fnam
 #define print_fn_out(p,m)
 #endif
 
+// 0 = quiet (-q), 1 = execution trace, 2 = also compiler chatter (-v)
+int verbosity = 1;
+
 bool enable_print_addr = true;
 bool enable_print_opcode = true;
 bool enable_stack_shift = true;
 bool enable_print_ds = true;
 bool enable_print_rs = true;
 
+__thread bool perf_counters_enabled = false;
+extern __thread unsigned int perf_depth;
+void perf_word_enter (uint8_t* body);
+void perf_word_exit (void);
+unsigned int perf_stash (unsigned int base, void** buf, unsigned int max);
+void perf_unstash (void** buf, unsigned int n);
+
+bool perf_map_enabled = false;
+uint32_t body_size (uint8_t* body);
+void perf_map_word (uint8_t* addr, uint32_t size, const char* name);
+
+__thread uint32_t tier_threshold = 0;    // 0 = tiering off
+void tier_promote (uint8_t* body);
+void tier_redefine (const char* name);
+
+__thread bool branch_profiling = false;
+int pgo_profile_len;
+void pgo_count (uint8_t* site, bool taken);
+
 
 void* atom_bye (void);
 void* atom_dup (void);
@@ -62,12 +105,71 @@ void* atom_begin (void);
 void* atom_until (void);
 void* atom_1compile1 (void);
 void* atom_postpone (void);
+void* atom_load_native (void);
+void* atom_fetch (void);
+void* atom_store (void);
+void* atom_cfetch (void);
+void* atom_cstore (void);
+void* atom_here (void);
+void* atom_allot (void);
+void* atom_comma (void);
+void* atom_cells (void);
+void* atom_create (void);
+void* atom_fill (void);
+void* atom_move (void);
+void* atom_sum (void);
+void* atom_vadd (void);
+void* atom_vmul (void);
+void* atom_dot (void);
+void* atom_vmin (void);
+void* atom_vmax (void);
+void* atom_vcount (void);
+void* atom_counters (void);
+void* atom_lit_plus (void);
+void* atom_jmpnz (void);
+void* atom_nip (void);
+void* atom_catch (void);
+void* atom_throw (void);
+void* atom_tick (void);
+void* atom_bracket_tick (void);
+void* atom_execute (void);
+void* atom_coro (void);
+void* atom_resume (void);
+void* atom_yield (void);
+void* atom_sliteral (void);
+void* atom_squote (void);
+void* atom_dotquote (void);
+void* atom_type (void);
+void* atom_emit (void);
+void* atom_print (void);
+void* atom_cr (void);
+void* atom_flush (void);
+void* atom_compare (void);
+void* atom_search (void);
+void* atom_hash (void);
+void* atom_par_map (void);
+void* atom_par_reduce (void);
+void* atom_ro (void);
+void* atom_wo (void);
+void* atom_rw (void);
+void* atom_open_file (void);
+void* atom_create_file (void);
+void* atom_read_file (void);
+void* atom_write_file (void);
+void* atom_close_file (void);
+void* atom_aread (void);
+void* atom_awrite (void);
+void* atom_await (void);
+void* atom_apoll (void);
 
 
 void* next (void);
+void* pino_throw (int code);
 void execute (uint8_t* body, uint8_t flags);
 char* find_word (char* word_to_find, uint8_t* is_user_word);
 char* lex(void);
+char* parse (char delim, uint32_t* len);
+bool compile_literal (int32_t val);
 
 
 #define CREATE_PLACEHOLDER(fn)      \
@@ -83,83 +185,295 @@ void* fn (void)                     \
 
 bool check_stack_underflows(void);
 
+// Native words, installed into the dictionary at startup.
 typedef struct {
-    void* link;
     char name[8];
     fword fn;
+    uint8_t flags;
 } native_fword;
 
-#define ADD_FLAGS(x,f)        (void*)((uint32_t)(x) + (f))
-
-
-native_fword native_dictionary[1000] = {
-    {NULL, "bye", atom_bye},
-    {&native_dictionary[0],                     "dup",      atom_dup},
-    {&native_dictionary[1],                     "swap",     atom_swap},
-    {&native_dictionary[2],                     "drop",     atom_drop},
-    {&native_dictionary[3],                     "not",      atom_not},
-    {&native_dictionary[4],                     "+",        atom_plus},
-    {&native_dictionary[5],                     "exit",     atom_exit},
-    {&native_dictionary[6],                     "literal",  atom_literal},
-    {&native_dictionary[7],                     "def",      atom_def},
-    {ADD_FLAGS(&native_dictionary[8],0x04),     ";",        atom_semicolon},
-    {&native_dictionary[9],                     "immedia",  atom_immediate},
-    {&native_dictionary[10],                    "jmp0",     atom_jmp0},
-    {&native_dictionary[11],                    "jmp",      atom_jmp},
-    {ADD_FLAGS(&native_dictionary[12],0x04),    "if",       atom_if},
-    {ADD_FLAGS(&native_dictionary[13],0x04),    "else",     atom_else},
-    {ADD_FLAGS(&native_dictionary[14],0x04),    "then",     atom_then},
-    {ADD_FLAGS(&native_dictionary[15],0x04),    "begin",    atom_begin},
-    {ADD_FLAGS(&native_dictionary[16],0x04),    "until",    atom_until},
-    {&native_dictionary[17],                    "[compil",  atom_1compile1},
-    {ADD_FLAGS(&native_dictionary[18],0x04),    "postpon",  atom_postpone},
-    {&native_dictionary[19],                    "nop",      atom_nop},
+native_fword native_words[] = {
+    {"bye",     atom_bye,            0},
+    {"dup",     atom_dup,            0},
+    {"swap",    atom_swap,           0},
+    {"drop",    atom_drop,           0},
+    {"not",     atom_not,            0},
+    {"+",       atom_plus,           0},
+    {"exit",    atom_exit,           0},
+    {"literal", atom_literal,        0},
+    {"def",     atom_def,            0},
+    {";",       atom_semicolon,      0x04},
+    {"immedia", atom_immediate,      0},
+    {"jmp0",    atom_jmp0,           0},
+    {"jmp",     atom_jmp,            0},
+    {"if",      atom_if,             0x04},
+    {"else",    atom_else,           0x04},
+    {"then",    atom_then,           0x04},
+    {"begin",   atom_begin,          0x04},
+    {"until",   atom_until,          0x04},
+    {"[compil", atom_1compile1,      0},
+    {"postpon", atom_postpone,       0x04},
+    {"nop",     atom_nop,            0},
+    {"load-na", atom_load_native,    0},
+    {"@",       atom_fetch,          0},
+    {"!",       atom_store,          0},
+    {"c@",      atom_cfetch,         0},
+    {"c!",      atom_cstore,         0},
+    {"here",    atom_here,           0},
+    {"allot",   atom_allot,          0},
+    {",",       atom_comma,          0},
+    {"cells",   atom_cells,          0},
+    {"create",  atom_create,         0},
+    {"fill",    atom_fill,           0},
+    {"move",    atom_move,           0},
+    {"sum",     atom_sum,            0},
+    {"vadd",    atom_vadd,           0},
+    {"vmul",    atom_vmul,           0},
+    {"dot",     atom_dot,            0},
+    {"vmin",    atom_vmin,           0},
+    {"vmax",    atom_vmax,           0},
+    {"vcount",  atom_vcount,         0},
+    {".counte", atom_counters,       0},
+    {"catch",   atom_catch,          0},
+    {"throw",   atom_throw,          0},
+    {"'",       atom_tick,           0},
+    {"[']",     atom_bracket_tick,   0x04},
+    {"execute", atom_execute,        0},
+    {"coro",    atom_coro,           0},
+    {"resume",  atom_resume,         0},
+    {"yield",   atom_yield,          0},
+    {"slitera", atom_sliteral,       0},
+    {"s\"",     atom_squote,         0x04},
+    {".\"",     atom_dotquote,       0x04},
+    {"type",    atom_type,           0},
+    {"emit",    atom_emit,           0},
+    {".",       atom_print,          0},
+    {"cr",      atom_cr,             0},
+    {"flush",   atom_flush,          0},
+    {"compare", atom_compare,        0},
+    {"search",  atom_search,         0},
+    {"hash",    atom_hash,           0},
+    {"par-map", atom_par_map,        0},
+    {"par-red", atom_par_reduce,     0},
+    {"r/o",     atom_ro,             0},
+    {"w/o",     atom_wo,             0},
+    {"r/w",     atom_rw,             0},
+    {"open-fi", atom_open_file,      0},
+    {"create-", atom_create_file,    0},
+    {"read-fi", atom_read_file,      0},
+    {"write-f", atom_write_file,     0},
+    {"close-f", atom_close_file,     0},
+    {"aread",   atom_aread,          0},
+    {"awrite",  atom_awrite,         0},
+    {"await",   atom_await,          0},
+    {"apoll",   atom_apoll,          0},
+    {"",        NULL,                0}
 };
 
-#define LAST_ENTRY_IDX 20
 
-uint8_t* dictionary = (uint8_t*)native_dictionary;
+// The dictionary is split in two.  Word headers sit in a compact table
+// that find_word() scans from the newest entry back.  What they point at,
+// native function cells, threaded bodies and create/allot data, is laid
+// out contiguously in the code arena at here.  User bodies are preceded
+// there by a call counter cell for tiering.
+typedef struct {
+    char name[8];
+    uint8_t* body;
+    uint32_t flags;     // 0x01 = user, 0x02 = hidden, 0x04 = immediate
+} word_header;
+
+#define MAX_WORDS           4096
+#define CODE_ARENA_SIZE     (1024 * 1024)
+
+word_header headers[MAX_WORDS];
+word_header* entry;     // Newest header, NULL when empty
 
-uint8_t* entry;
+// Page aligned, so the arena can be mapped on its own.
+alignas(4096) uint8_t code_arena[CODE_ARENA_SIZE];
 uint8_t* here;
 
+static inline word_header* prev_entry (word_header* cur)
+{
+    return (cur == headers) ? NULL : cur - 1;
+}
+
+static inline void align_here (void)
+{
+    here = (void*)((uint32_t)(here + 3) & ~0x3);
+}
+
+// Whether here can move by n bytes and stay inside the code arena.
+static inline bool arena_room (int64_t n)
+{
+    int64_t at = (int64_t)(here - code_arena) + n;
+
+    return (at >= 0 && at <= CODE_ARENA_SIZE);
+}
+
+word_header* add_header (const char* name, uint8_t* body, uint32_t flags);
+word_header* header_of (uint8_t* body);
+int collect_user_entries (word_header*** list);
+void perf_map_entry (word_header* cur, uint32_t size);
+void pgo_layout (word_header* cur);
+
 
 #define BASE_OF_STACK   10
 #define MAX_STACK_SIZE 1000
-uintptr_t return_stack[1000];
-uintptr_t data_stack[1000];
-unsigned int tors;
-unsigned int tods;
+__thread uintptr_t return_stack[1000];
+__thread uintptr_t data_stack[1000];
+__thread unsigned int tors;
+__thread unsigned int tods;
 #define INPUT_BUFFER_SIZE 256
 char input_buffer[INPUT_BUFFER_SIZE];
 unsigned int input_offset;
 bool compiler_state = false;    // true = Compiler, false = Interpreter
 
-void check_stack_range(void)
+// Standard Forth throw codes for the errors pino raises itself.
+enum {
+    THROW_STACK_OVERFLOW    = -3,
+    THROW_STACK_UNDERFLOW   = -4,
+    THROW_RSTACK_OVERFLOW   = -5,
+    THROW_RSTACK_UNDERFLOW  = -6,
+    THROW_DICT_OVERFLOW     = -8,
+    THROW_UNDEFINED         = -13,
+    THROW_UNSUPPORTED       = -21,
+};
+
+__thread unsigned int catch_frame;  // Return stack index of the newest catch frame, 0 if none
+__thread int pending_throw;         // Uncaught throw code, for the REPL to report
+bool bye_requested;
+uint8_t* def_start;         // here before the definition being compiled
+
+// Returns the throw code for an out of range stack, or 0.
+int check_stack_range(void)
 {
     if (tors < BASE_OF_STACK) {
-        printf("Return stack underflow by %d entries\n", BASE_OF_STACK - tors);
-        exit(1);
+        return THROW_RSTACK_UNDERFLOW;
     }
 
     if (tods < BASE_OF_STACK) {
-        printf("Data stack underflow by %d entries\n", BASE_OF_STACK - tods);
-        exit(1);
+        return THROW_STACK_UNDERFLOW;
     }
 
     if (tors >= MAX_STACK_SIZE) {
-        printf("Return stack overflow by %d entries\n", tors - (MAX_STACK_SIZE - 1));
-        exit(1);
+        return THROW_RSTACK_OVERFLOW;
     }
 
     if (tods >= MAX_STACK_SIZE) {
-        printf("Data stack overflow by %d entries\n", tods - (MAX_STACK_SIZE - 1));
-        exit(1);
+        return THROW_STACK_OVERFLOW;
+    }
+
+    return 0;
+}
+
+const char* throw_message (int code)
+{
+    switch (code) {
+    case THROW_STACK_OVERFLOW:      return "Data stack overflow";
+    case THROW_STACK_UNDERFLOW:     return "Data stack underflow";
+    case THROW_RSTACK_OVERFLOW:     return "Return stack overflow";
+    case THROW_RSTACK_UNDERFLOW:    return "Return stack underflow";
+    case THROW_DICT_OVERFLOW:       return "Dictionary full";
+    case THROW_UNDEFINED:           return "Undefined word";
+    case THROW_UNSUPPORTED:         return "Unsupported operation";
+    default:                        return NULL;
+    }
+}
+
+
+
+
+
+// Buffered output.  Everything the interpreter prints goes through
+// out_buffer and reaches stdout in large writes: when the buffer fills,
+// on flush, before waiting for input, and at exit.  Only a terminal gets
+// each write straight away.  par-map workers print too, hence the lock.
+
+#define OUT_BUFFER_SIZE     (64 * 1024)
+
+char out_buffer[OUT_BUFFER_SIZE];
+uint32_t out_len;
+bool out_is_tty;
+pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void out_drain (const char* str, uint32_t len)
+{
+    while (len > 0) {
+        ssize_t put = write(STDOUT_FILENO, str, len);
+
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        str += put;
+        len -= put;
+    }
+}
+
+void out_flush (void)
+{
+    pthread_mutex_lock(&out_lock);
+    out_drain(out_buffer, out_len);
+    out_len = 0;
+    pthread_mutex_unlock(&out_lock);
+}
+
+void out_write (const char* str, uint32_t len)
+{
+    pthread_mutex_lock(&out_lock);
+
+    if (out_len + len > OUT_BUFFER_SIZE) {
+        out_drain(out_buffer, out_len);
+        out_len = 0;
+    }
+
+    if (len > OUT_BUFFER_SIZE) {
+        out_drain(str, len);
+    } else {
+        memcpy(out_buffer + out_len, str, len);
+        out_len += len;
+    }
+
+    if (out_is_tty) {
+        out_drain(out_buffer, out_len);
+        out_len = 0;
     }
+
+    pthread_mutex_unlock(&out_lock);
 }
 
+int out_printf (const char* fmt, ...)
+{
+    char str[256];
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(str, sizeof(str), fmt, args);
+    va_end(args);
+
+    if (len < 0) {
+        return len;
+    }
+
+    if ((size_t)len < sizeof(str)) {
+        out_write(str, len);
+    } else {
+        char* big = malloc(len + 1);
+
+        va_start(args, fmt);
+        vsnprintf(big, len + 1, fmt, args);
+        va_end(args);
 
+        out_write(big, len);
+        free(big);
+    }
 
+    return len;
+}
 
 
 #define PRINT_BUF_SIZE  120
@@ -170,6 +484,10 @@ void print_fn_impl (void* fp, const char* msg, const char* out, const char* fnam
     int null_idx = 0;
     int len;
 
+    if (verbosity < 1) {
+        return;
+    }
+
     // Space fill buffer and null terminate
     memset(str, ' ', sizeof(str));
     str[PRINT_BUF_SIZE - 1] = '\0';
@@ -218,10 +536,8 @@ void print_fn_impl (void* fp, const char* msg, const char* out, const char* fnam
     str[PRINT_BUF_SIZE - 1] = '\0';
 
     if (null_idx > 0) {
-        printf("%s\n", str);
+        out_printf("%s\n", str);
     }
-
-    fflush(stdout);
 }
 
 int print_ds(char* str, int len)
@@ -301,6 +617,15 @@ void* next (void)
         push_r(i_ptr);
         i_ptr = (fword*)tmp;
 
+        if (perf_counters_enabled) {
+            perf_word_enter((uint8_t*)tmp);
+        }
+
+        // Bump the call counter ahead of the body.
+        if (tier_threshold != 0 && ++*((uint32_t*)tmp - 1) == tier_threshold) {
+            tier_promote((uint8_t*)tmp);
+        }
+
         return next();
     } else {
         return (void*)tmp;
@@ -330,6 +655,10 @@ void* atom_1compile1 (void)
 {
     char numstr[20];
 
+    if (!arena_room(4)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
     // Compile the next instruction instead of running it.
     memcpy(here, i_ptr, 4);
     sprintf(numstr, "compile %p", *i_ptr);
@@ -355,6 +684,10 @@ void* atom_exit (void)
 {
     print_fn(atom_exit);
 
+    if (perf_counters_enabled) {
+        perf_word_exit();
+    }
+
     i_ptr = pop_r();
 
     if (i_ptr != NULL) {
@@ -365,613 +698,4801 @@ void* atom_exit (void)
 }
 
 
-void* atom_begin (void)
+// Coroutines.  Each one owns the return stack cells above co_base while
+// it runs.  yield copies that segment out and drops back to whoever
+// resumed it; resume copies it back in on top of the resumer's frames,
+// so a switch costs a few cells of copying.  Values pass on the data
+// stack, which is shared.
+//
+//     : gen  1 yield 2 yield ;
+//     ' gen coro  dup resume  ( co 1 -1 )
+
+#define CORO_STACK_CELLS    64
+
+typedef struct coroutine {
+    fword start[2];             // Runs the xt, then atom_coro_done
+    fword* ip;                  // Where it carries on when resumed
+    uint32_t state;
+    unsigned int depth;         // Saved return stack cells
+    unsigned int catch_top;     // Newest saved catch frame, relative to the base, 0 if none
+    unsigned int perf_n;        // Saved perf counter levels
+    struct coroutine* next;     // All coroutines, newest first
+    uintptr_t stack[CORO_STACK_CELLS];
+    void* perf[CORO_STACK_CELLS];
+} coroutine;
+
+enum { CORO_SUSPENDED, CORO_RUNNING, CORO_DONE };
+
+// The frame resume pushes under the segment, as offsets below co_base.
+#define CO_PREV_BASE        0
+#define CO_PREV             1
+#define CO_PERF             2
+#define CO_IP               3
+
+coroutine* coroutines;
+__thread coroutine* current_co;     // NULL outside of any coroutine
+__thread unsigned int co_base;      // Top of the frames below the running coroutine
+
+// Unwinding to a frame outside of the running coroutines ends them; they
+// can't carry on once their segment is gone.
+static void coro_abandon (coroutine* target)
 {
-    print_fn(atom_begin);
-    push_d((intptr_t)here);
-
-    return next();
+    while (current_co != NULL && current_co != target) {
+        current_co->state = CORO_DONE;
+        current_co = (coroutine*)return_stack[co_base - CO_PREV];
+        co_base = (unsigned int)return_stack[co_base - CO_PREV_BASE];
+    }
 }
 
-void* atom_until (void)
-{
-    uint8_t* tmp;
-    int32_t offset;
-    char msg[40];
-
-    // Compile atom_jmp0 to *here
-    // here += 4
-    *(fword*)here = atom_jmp0;
-    here += 4;
-
-    tmp = (uint8_t*)pop_d();
-
-    // Store offset to begin in *here
-    offset = (int32_t)(tmp - here - 4);
-    *(int32_t*)here = offset;
 
-    here += 4;
+// Exceptions.  catch pushes a frame on the return stack holding the
+// continuation, the data stack depth, the perf counter depth, the
+// running coroutine and the previous frame, then runs the xt.  A normal
+// return drops the frame and pushes 0; throw cuts the return stack back
+// to the newest frame and restores it instead.  Nothing is checked on
+// the way through, so code that doesn't throw runs at full speed.  An xt
+// is the address of a word's header.
+
+// Frame cells, as offsets below the frame's index.
+#define CATCH_PREV          0
+#define CATCH_CO            1
+#define CATCH_CO_BASE       2
+#define CATCH_PERF          3
+#define CATCH_TODS          4
+#define CATCH_IP            5
+
+void* atom_uncatch (void);
+void* atom_execute_ret (void);
+
+// Threads that run an xt and then come back.  Only the first cell is
+// replaced, and next() reads it straight away, so nesting is safe.
+__thread fword catch_thread[] = {
+    atom_nop,   // Replaced by the xt to run.
+    atom_uncatch
+};
 
-    sprintf(msg, "fill offset %d", offset);
+__thread fword execute_thread[] = {
+    atom_nop,   // Replaced by the xt to run.
+    atom_execute_ret
+};
 
-    print_fn_msg(atom_until, msg);
+static fword xt_cell (word_header* xt)
+{
+    if (xt->flags & 0x01) {
+        return (fword)((uint32_t)xt->body | 0x01);
+    }
 
-    return next();
+    return *(fword*)xt->body;
 }
 
-
-void* atom_def (void)
+// Pop an xt, NULL if it isn't a visible word.
+static word_header* pop_xt (void)
 {
-    char* tok = lex();  // Get the next input
+    word_header* xt = (word_header*)pop_d();
 
-    if (tok == NULL) {
+    if (entry == NULL || xt < headers || xt > entry ||
+        ((uint8_t*)xt - (uint8_t*)headers) % sizeof(word_header) != 0 ||
+        (xt->flags & 0x02)) {
         return NULL;
     }
 
-    // Push here pointer to be 8-byte aligned
-    here = (void*)((uint32_t)(here + 7) & ~0x7);
+    return xt;
+}
 
-    // Create new inactive dictionary entry
-    *(uint32_t*)here = (uint32_t)entry | 0x01 | 0x02;
-    entry = here;
-    here += 4;
-    strncpy(here, tok, 7);
-    here[7] = '\0';
-    here += 8;
+// Pop the newest catch frame, restoring what it saved.
+static void catch_unwind (void)
+{
+    uintptr_t* frame = &return_stack[catch_frame];
 
-    compile_mode = true;
+    coro_abandon((coroutine*)frame[-CATCH_CO]);
 
+    tors = catch_frame - CATCH_IP - 1;
+    catch_frame = (unsigned int)frame[-CATCH_PREV];
+    co_base = (unsigned int)frame[-CATCH_CO_BASE];
+    perf_depth = (unsigned int)frame[-CATCH_PERF];
+    tods = (unsigned int)frame[-CATCH_TODS];
+    i_ptr = (fword*)frame[-CATCH_IP];
+}
+
+// Raise code: resume after the newest catch, or stop the inner loop and
+// leave it for the REPL to report.
+void* pino_throw (int code)
+{
+    // A frame above tors has already been popped off by a bad exit.
+    if (catch_frame == 0 || catch_frame > tors) {
+        catch_frame = 0;
+        pending_throw = code;
+        return NULL;
+    }
+
+    catch_unwind();
+    push_d(code);
 
-    print_fn_msg(atom_def, tok);
     return next();
 }
 
-void* atom_semicolon (void)
+void* atom_catch (void)
 {
-    uint32_t link;
+    word_header* xt = pop_xt();
 
-    compile_mode = false;
-
-    *(fword*)here = atom_exit;
-    here += 4;
+    print_fn(atom_catch);
 
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
 
-    // Enable the entry
-    *(uint32_t*)entry = *(uint32_t*)entry & ~0x02;
+    push_r(i_ptr);
+    push_r((fword*)(uintptr_t)tods);
+    push_r((fword*)(uintptr_t)perf_depth);
+    push_r((fword*)(uintptr_t)co_base);
+    push_r((fword*)current_co);
+    push_r((fword*)(uintptr_t)catch_frame);
+    catch_frame = tors;
 
+    catch_thread[0] = xt_cell(xt);
+    i_ptr = catch_thread;
 
-    print_fn(atom_semicolon);
     return next();
 }
 
-
-void* atom_swap (void)
+void* atom_uncatch (void)
 {
-    uintptr_t tmp = data_stack[tods];
+    print_fn(atom_uncatch);
 
-    data_stack[tods] = data_stack[tods - 1];
-    data_stack[tods-1]     = tmp;
+    // The xt returned normally, so the frame is on top.
+    catch_unwind();
+    push_d(0);
 
-    print_fn(atom_swap);
     return next();
 }
 
-void* atom_immediate (void)
+void* atom_throw (void)
 {
-    uint32_t link;
+    int code = (int)pop_d();
 
-    link = *(uint32_t*) entry;
-    link |= 0x04;   // Set immediate flag.
-    link = *(uint32_t*) entry = link;
-    
-    print_fn(atom_immediate);
-    return next();
-}
+    print_fn(atom_throw);
 
+    if (code == 0) {
+        return next();
+    }
 
+    return pino_throw(code);
+}
 
-void* atom_jmp0 (void)
+void* atom_execute (void)
 {
-    char numstr[20];
-
-    // Interpret the next location as an offset
-    int offset = (intptr_t)*i_ptr;
-    i_ptr++;
+    word_header* xt = pop_xt();
 
+    print_fn(atom_execute);
 
-    int val = pop_d ();
-
-    // Only jump if 0 was on the data stack
-    if (val == 0) {
-        i_ptr += offset/sizeof(fword*);
-        sprintf(numstr, "jmp0 by %d", offset);
-    } else {
-        sprintf(numstr, "no jmp, val: %d", val);
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
     }
 
-    print_fn_msg(atom_jmp, numstr);
-
+    push_r(i_ptr);
 
+    execute_thread[0] = xt_cell(xt);
+    i_ptr = execute_thread;
 
     return next();
 }
 
+// Like exit, but without a perf counter level to pop.
+void* atom_execute_ret (void)
+{
+    print_fn(atom_execute_ret);
 
+    i_ptr = pop_r();
+    return next();
+}
 
-void* atom_jmp (void)
+static word_header* find_header (const char* name)
 {
-    char numstr[20];
+    word_header* cur;
 
-    // Interpret the next location as an offset
-    int offset = (intptr_t)*i_ptr;
-    i_ptr++;
+    for (cur = entry; cur != NULL; cur = prev_entry(cur)) {
+        if ((cur->flags & 0x02) == 0 && !strncmp(name, cur->name, 7)) {
+            return cur;
+        }
+    }
 
-    // Perform the actual jump
-    i_ptr += offset/sizeof(fword*);
+    return NULL;
+}
 
+// ' name ( -- xt )
+void* atom_tick (void)
+{
+    char* tok = lex();
+    word_header* xt;
 
-    sprintf(numstr, "jmp by %d", offset);
-    print_fn_msg(atom_jmp, numstr);
+    if (tok == NULL) {
+        return NULL;
+    }
 
+    xt = find_header(tok);
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
 
+    print_fn_msg(atom_tick, tok);
 
+    push_d((intptr_t)xt);
     return next();
 }
 
+static void coro_leave (void)
+{
+    tors = co_base;
+    co_base = (unsigned int)pop_r();
+    current_co = (coroutine*)pop_r();
+    perf_depth = (unsigned int)(uintptr_t)pop_r();
+    i_ptr = pop_r();
+}
 
+void* atom_coro_done (void);
 
-void* atom_dup (void)
+// coro ( xt -- co )
+void* atom_coro (void)
 {
-    push_d (data_stack[tods]);
+    word_header* xt = pop_xt();
+    coroutine* co;
 
-    print_fn(atom_dup);
-    return next();
-}
+    print_fn(atom_coro);
 
-void* atom_not (void)
-{
-    data_stack[tods] = !(data_stack[tods]);
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
 
-    print_fn(atom_not);
-    return next();
-}
+    // Lives in the dictionary, like create data.
+    align_here();
+    if (here + sizeof(coroutine) > code_arena + CODE_ARENA_SIZE) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
 
+    co = (coroutine*)here;
+    here += sizeof(coroutine);
 
-void* atom_nop (void)
-{
-    print_fn(atom_nop);
+    memset(co, 0, sizeof(*co));
+    co->start[0] = xt_cell(xt);
+    co->start[1] = atom_coro_done;
+    co->ip = co->start;
+    co->state = CORO_SUSPENDED;
+    co->next = coroutines;
+    coroutines = co;
+
+    push_d((intptr_t)co);
     return next();
 }
 
-void* atom_drop ()
+// Pop a coroutine, NULL if coro didn't make it.
+static coroutine* pop_coro (void)
 {
-    pop_d ();
+    coroutine* handle = (coroutine*)pop_d();
+    coroutine* co;
 
-    print_fn(atom_drop);
-    return next();
+    for (co = coroutines; co != NULL; co = co->next) {
+        if (co == handle) {
+            return co;
+        }
+    }
+
+    return NULL;
 }
 
-void* atom_plus (void)
+// resume ( co -- flag ), true if it yielded, false once it has finished.
+void* atom_resume (void)
 {
-    int a, b;
+    coroutine* co = pop_coro();
 
-    a = (int)pop_d();
-    b = (int)pop_d();
-    a += b;
-    push_d((intptr_t)a);
+    print_fn(atom_resume);
 
-    print_fn(atom_plus);
-    return next();
-}
+    if (co == NULL || co->state == CORO_RUNNING) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
 
+    if (co->state == CORO_DONE) {
+        push_d(0);
+        return next();
+    }
 
-void* atom_if (void)
-{
-    char msg[40];
+    if (tors + 4 + co->depth >= MAX_STACK_SIZE) {
+        return pino_throw(THROW_RSTACK_OVERFLOW);
+    }
 
-    // Compile atom_jmp0 to *here
-    // here += 4
-    *(fword*)here = atom_jmp0;
-    here += 4;
+    push_r(i_ptr);
+    push_r((fword*)(uintptr_t)perf_depth);
+    push_r((fword*)current_co);
+    push_r((fword*)(uintptr_t)co_base);
+    co_base = tors;
 
-    // push_ds(here)
-    sprintf(msg, "push %p on stack", here);
-    push_d((intptr_t)here);
+    memcpy(&return_stack[tors + 1], co->stack, co->depth * sizeof(uintptr_t));
+    tors += co->depth;
 
-    here += 4;
+    // Chain the saved catch frames onto the current ones.
+    if (co->catch_top != 0) {
+        unsigned int frame = co_base + co->catch_top;
+        unsigned int outer = catch_frame;
 
-    print_fn_msg(atom_if, msg);
+        catch_frame = frame;
+
+        while (1) {
+            unsigned int prev = (unsigned int)return_stack[frame - CATCH_PREV];
+
+            return_stack[frame - CATCH_PREV] = (prev != 0) ? co_base + prev : outer;
+            return_stack[frame - CATCH_CO_BASE] = co_base;
+            return_stack[frame - CATCH_PERF] += perf_depth;
+
+            if (prev == 0) {
+                break;
+            }
+
+            frame = co_base + prev;
+        }
+    }
+
+    perf_unstash(co->perf, co->perf_n);
+
+    co->state = CORO_RUNNING;
+    current_co = co;
+    i_ptr = co->ip;
 
     return next();
 }
 
-void* atom_else (void)
+void* atom_yield (void)
 {
-    uint8_t* tmp;
-    int32_t offset;
-    char msg[40];
+    coroutine* co = current_co;
+    unsigned int depth = tors - co_base;
+    unsigned int perf_base;
+    unsigned int frame;
 
-    // Compile atom_jmp to *here
-    // here += 4
-    *(fword*)here = atom_jmp;
-    here += 4;
+    print_fn(atom_yield);
 
-    tmp = (uint8_t*)pop_d();
+    if (co == NULL) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
 
-    // Store address for previous 'if'
-    offset = (int32_t)(here - tmp);
-    *(int32_t*)tmp = offset;
+    if (depth > CORO_STACK_CELLS) {
+        return pino_throw(THROW_RSTACK_OVERFLOW);
+    }
 
-    sprintf(msg, "fill %d, push %p", offset, here);
-    push_d((intptr_t)here);
+    perf_base = (unsigned int)return_stack[co_base - CO_PERF];
 
-    here += 4;
+    // Catch frames in the segment are saved relative to its base, since
+    // it may be resumed at another depth.
+    co->catch_top = (catch_frame > co_base) ? catch_frame - co_base : 0;
 
-    print_fn_msg(atom_else, msg);
+    for (frame = catch_frame; frame > co_base; ) {
+        unsigned int prev = (unsigned int)return_stack[frame - CATCH_PREV];
+
+        return_stack[frame - CATCH_PREV] = (prev > co_base) ? prev - co_base : 0;
+        return_stack[frame - CATCH_PERF] -= perf_base;
+        frame = prev;
+    }
+
+    catch_frame = frame;
+
+    memcpy(co->stack, &return_stack[co_base + 1], depth * sizeof(uintptr_t));
+    co->depth = depth;
+    co->ip = i_ptr;
+    co->perf_n = perf_stash(perf_base, co->perf, CORO_STACK_CELLS);
+    co->state = CORO_SUSPENDED;
+
+    coro_leave();
+    push_d(-1);
 
     return next();
 }
 
-void* atom_then (void)
+// The coroutine's xt returned.
+void* atom_coro_done (void)
+{
+    print_fn(atom_coro_done);
+
+    current_co->state = CORO_DONE;
+
+    coro_leave();
+    push_d(0);
+
+    return next();
+}
+
+// Whether a suspended coroutine would carry on inside (body, body+size].
+static bool coro_holds (uint8_t* body, uint32_t size)
+{
+    coroutine* co;
+    unsigned int idx;
+
+    for (co = coroutines; co != NULL; co = co->next) {
+        if (co->state != CORO_SUSPENDED) {
+            continue;
+        }
+
+        if ((uint8_t*)co->ip > body && (uint8_t*)co->ip <= body + size) {
+            return true;
+        }
+
+        for (idx = 0; idx < co->depth; idx++) {
+            uint8_t* ret = (uint8_t*)co->stack[idx];
+
+            if (ret > body && ret <= body + size) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// ['] name, compiles the xt as a literal.
+void* atom_bracket_tick (void)
+{
+    char* tok = lex();
+    word_header* xt;
+
+    if (tok == NULL) {
+        return NULL;
+    }
+
+    xt = find_header(tok);
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
+
+    print_fn_msg(atom_bracket_tick, tok);
+
+    if (!compile_literal((int32_t)xt)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    return next();
+}
+
+
+void* atom_begin (void)
+{
+    print_fn(atom_begin);
+    push_d((intptr_t)here);
+
+    return next();
+}
+
+void* atom_until (void)
 {
     uint8_t* tmp;
     int32_t offset;
     char msg[40];
 
-    // Pop the address to be filled from the stack
+    if (!arena_room(8)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    // Compile atom_jmp0 to *here
+    // here += 4
+    *(fword*)here = atom_jmp0;
+    here += 4;
+
     tmp = (uint8_t*)pop_d();
 
-    // Store address for previous 'if' or 'else'
-    offset = (int32_t)(here - tmp - 4);
-    *(int32_t*)tmp = offset;
+    // Store offset to begin in *here
+    offset = (int32_t)(tmp - here - 4);
+    *(int32_t*)here = offset;
+
+    here += 4;
+
+    sprintf(msg, "fill offset %d", offset);
+
+    print_fn_msg(atom_until, msg);
+
+    return next();
+}
+
+
+void* atom_def (void)
+{
+    char* tok = lex();  // Get the next input
+
+    if (tok == NULL) {
+        return NULL;
+    }
+
+    tier_redefine(tok);
+
+    // Where to roll back to if the definition is abandoned.
+    def_start = here;
+
+    align_here();
+    if (!arena_room(4)) {
+        here = def_start;
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    *(uint32_t*)here = 0;   // Call counter
+    here += 4;
+
+    // Create new inactive dictionary entry
+    if (add_header(tok, here, 0x01 | 0x02) == NULL) {
+        here = def_start;
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    compile_mode = true;
+
+
+    print_fn_msg(atom_def, tok);
+    return next();
+}
+
+void* atom_semicolon (void)
+{
+    compile_mode = false;
+
+    if (!arena_room(4)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    *(fword*)here = atom_exit;
+    here += 4;
+
+    if (pgo_profile_len > 0) {
+        pgo_layout(entry);
+    }
+
+    // Enable the entry
+    entry->flags &= ~0x02;
+
+    if (perf_map_enabled) {
+        perf_map_entry(entry, here - entry->body);
+    }
+
+    print_fn(atom_semicolon);
+    return next();
+}
+
+
+word_header* add_header (const char* name, uint8_t* body, uint32_t flags)
+{
+    word_header* hdr = (entry == NULL) ? headers : entry + 1;
+
+    if (hdr >= headers + MAX_WORDS) {
+        return NULL;
+    }
+
+    strncpy(hdr->name, name, 7);
+    hdr->name[7] = '\0';
+    hdr->body = body;
+    hdr->flags = flags;
+    entry = hdr;
+
+    return hdr;
+}
+
+// The header of a word, found from its body.
+word_header* header_of (uint8_t* body)
+{
+    word_header* cur;
+
+    for (cur = entry; cur != NULL; cur = prev_entry(cur)) {
+        if (cur->body == body) {
+            return cur;
+        }
+    }
+
+    return NULL;
+}
+
+int pino_register_failures;     // Counted for load-native to report
+
+// Link a native word into the dictionary.  Used at startup for
+// native_words[], and by plugins to add their own primitives.
+bool pino_register (const char* name, fword fn, uint8_t flags)
+{
+    if (name == NULL || fn == NULL || ((uint32_t)fn & 0x01)) {
+        pino_register_failures++;
+        return false;
+    }
+
+    align_here();
+
+    if (!arena_room(4) || add_header(name, here, flags & 0x04) == NULL) {
+        pino_register_failures++;
+        return false;
+    }
+
+    *(fword*)here = fn;
+    here += 4;
+
+    return true;
+}
+
+void* atom_load_native (void)
+{
+    char* tok = lex();  // Get the library path
+    void* lib;
+    void (*init)(void);
+
+    if (tok == NULL) {
+        return NULL;
+    }
+
+    print_fn_msg(atom_load_native, tok);
+
+    lib = dlopen(tok, RTLD_NOW | RTLD_GLOBAL);
+    if (lib == NULL) {
+        out_printf("load-native: %s\n", dlerror());
+        return next();
+    }
+
+    *(void**)&init = dlsym(lib, "pino_plugin_init");
+    if (init == NULL) {
+        out_printf("load-native: %s has no pino_plugin_init\n", tok);
+        dlclose(lib);
+        return next();
+    }
+
+    pino_register_failures = 0;
+    init();
+
+    if (pino_register_failures > 0) {
+        out_printf("load-native: %s: %d word(s) could not be registered\n",
+                   tok, pino_register_failures);
+    }
+
+    return next();
+}
+
+
+void* atom_swap (void)
+{
+    uintptr_t tmp = data_stack[tods];
+
+    data_stack[tods] = data_stack[tods - 1];
+    data_stack[tods-1]     = tmp;
+
+    print_fn(atom_swap);
+    return next();
+}
+
+void* atom_immediate (void)
+{
+    entry->flags |= 0x04;   // Set immediate flag.
+
+    print_fn(atom_immediate);
+    return next();
+}
+
+
+
+void* atom_jmp0 (void)
+{
+    char numstr[20];
+
+    // Interpret the next location as an offset
+    int offset = (intptr_t)*i_ptr;
+    i_ptr++;
+
+
+    int val = pop_d ();
+
+    if (branch_profiling) {
+        pgo_count((uint8_t*)(i_ptr - 2), val == 0);
+    }
+
+    // Only jump if 0 was on the data stack
+    if (val == 0) {
+        i_ptr += offset/sizeof(fword*);
+        sprintf(numstr, "jmp0 by %d", offset);
+    } else {
+        sprintf(numstr, "no jmp, val: %d", val);
+    }
+
+    print_fn_msg(atom_jmp, numstr);
+
+
+
+    return next();
+}
+
+
+
+void* atom_jmp (void)
+{
+    char numstr[20];
+
+    // Interpret the next location as an offset
+    int offset = (intptr_t)*i_ptr;
+    i_ptr++;
+
+    // Perform the actual jump
+    i_ptr += offset/sizeof(fword*);
+
+
+    sprintf(numstr, "jmp by %d", offset);
+    print_fn_msg(atom_jmp, numstr);
+
 
-    sprintf(msg, "fill %d in", offset);
-    print_fn_msg(atom_then, msg);
 
     return next();
 }
 
-char* find_word (char* word_to_find, uint8_t* flags)
+
+
+// Superinstructions.  These have no dictionary entries, only the tier
+// compiler puts them into optimized bodies.
+
+void* atom_lit_plus (void)
+{
+    char numstr[20];
+
+    // Add the next location to the top of stack and skip it.
+    int num = (intptr_t)*i_ptr;
+    i_ptr++;
+
+    data_stack[tods] = (intptr_t)((int)data_stack[tods] + num);
+
+    sprintf(numstr, "%d", num);
+    print_fn_msg(atom_lit_plus, numstr);
+
+    return next();
+}
+
+void* atom_jmpnz (void)
+{
+    char numstr[20];
+
+    // Interpret the next location as an offset
+    int offset = (intptr_t)*i_ptr;
+    i_ptr++;
+
+    int val = pop_d ();
+
+    // Only jump if the value was non-zero, i.e. "not jmp0"
+    if (val != 0) {
+        i_ptr += offset/sizeof(fword*);
+        sprintf(numstr, "jmpnz by %d", offset);
+    } else {
+        sprintf(numstr, "no jmp, val: %d", val);
+    }
+
+    print_fn_msg(atom_jmpnz, numstr);
+
+    return next();
+}
+
+void* atom_nip (void)
+{
+    data_stack[tods - 1] = data_stack[tods];
+    tods--;
+
+    print_fn(atom_nip);
+    return next();
+}
+
+
+
+void* atom_dup (void)
+{
+    push_d (data_stack[tods]);
+
+    print_fn(atom_dup);
+    return next();
+}
+
+void* atom_not (void)
+{
+    data_stack[tods] = !(data_stack[tods]);
+
+    print_fn(atom_not);
+    return next();
+}
+
+
+void* atom_nop (void)
+{
+    print_fn(atom_nop);
+    return next();
+}
+
+void* atom_drop ()
+{
+    pop_d ();
+
+    print_fn(atom_drop);
+    return next();
+}
+
+void* atom_plus (void)
+{
+    int a, b;
+
+    a = (int)pop_d();
+    b = (int)pop_d();
+    a += b;
+    push_d((intptr_t)a);
+
+    print_fn(atom_plus);
+    return next();
+}
+
+
+// Memory access.  Cells are 32 bits, matching the dictionary.
+
+void* atom_fetch (void)
+{
+    data_stack[tods] = *(int32_t*)data_stack[tods];
+
+    print_fn(atom_fetch);
+    return next();
+}
+
+void* atom_store (void)
+{
+    int32_t* addr = (int32_t*)pop_d();
+
+    *addr = (int32_t)pop_d();
+
+    print_fn(atom_store);
+    return next();
+}
+
+void* atom_cfetch (void)
+{
+    data_stack[tods] = *(uint8_t*)data_stack[tods];
+
+    print_fn(atom_cfetch);
+    return next();
+}
+
+void* atom_cstore (void)
+{
+    uint8_t* addr = (uint8_t*)pop_d();
+
+    *addr = (uint8_t)pop_d();
+
+    print_fn(atom_cstore);
+    return next();
+}
+
+void* atom_here (void)
+{
+    push_d((intptr_t)here);
+
+    print_fn(atom_here);
+    return next();
+}
+
+void* atom_allot (void)
+{
+    int32_t n = (int32_t)pop_d();
+
+    if (!arena_room(n)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    here += n;
+
+    print_fn(atom_allot);
+    return next();
+}
+
+void* atom_comma (void)
+{
+    int32_t val = (int32_t)pop_d();
+
+    if (!arena_room(4)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    memcpy(here, &val, 4);
+    here += 4;
+
+    print_fn(atom_comma);
+    return next();
+}
+
+void* atom_cells (void)
+{
+    data_stack[tods] *= 4;
+
+    print_fn(atom_cells);
+    return next();
+}
+
+void* atom_create (void)
+{
+    char* tok = lex();  // Get the next input
+
+    if (tok == NULL) {
+        return NULL;
+    }
+
+    align_here();
+    if (!arena_room(16)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    *(uint32_t*)here = 0;   // Call counter
+    here += 4;
+
+    // A user entry whose body pushes the address of the data following it.
+    if (add_header(tok, here, 0x01) == NULL) {
+        here -= 4;
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    *(fword*)here = atom_literal;
+    here += 4;
+    *(uint32_t*)here = (uint32_t)(here + 8);
+    here += 4;
+    *(fword*)here = atom_exit;
+    here += 4;
+
+    if (perf_map_enabled) {
+        perf_map_entry(entry, 12);
+    }
+
+    print_fn_msg(atom_create, tok);
+    return next();
+}
+
+
+// Bulk cell array kernels, with SSE2/AVX2 versions picked at startup by
+// init_vector_ops().  Arithmetic wraps like the 32-bit cells it works on.
+// mismatch and search work on bytes, for the string words.
+
+typedef struct {
+    void     (*fill)  (int32_t* dst, uint32_t n, int32_t x);
+    int32_t  (*sum)   (const int32_t* src, uint32_t n);
+    void     (*add)   (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n);
+    void     (*mul)   (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n);
+    int32_t  (*dot)   (const int32_t* a, const int32_t* b, uint32_t n);
+    int32_t  (*min)   (const int32_t* src, uint32_t n);
+    int32_t  (*max)   (const int32_t* src, uint32_t n);
+    uint32_t (*count) (const int32_t* src, uint32_t n, int32_t x);
+    uint32_t (*mismatch) (const uint8_t* a, const uint8_t* b, uint32_t n);
+    int32_t  (*search) (const uint8_t* hay, uint32_t n, const uint8_t* needle, uint32_t m);
+} vector_ops;
+
+static void fill_scalar (int32_t* dst, uint32_t n, int32_t x)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = x;
+    }
+}
+
+static int32_t sum_scalar (const int32_t* src, uint32_t n)
+{
+    uint32_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        acc += (uint32_t)src[i];
+    }
+
+    return (int32_t)acc;
+}
+
+static void add_scalar (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+    }
+}
+
+static void mul_scalar (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = (int32_t)((uint32_t)a[i] * (uint32_t)b[i]);
+    }
+}
+
+static int32_t dot_scalar (const int32_t* a, const int32_t* b, uint32_t n)
+{
+    uint32_t acc = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        acc += (uint32_t)a[i] * (uint32_t)b[i];
+    }
+
+    return (int32_t)acc;
+}
+
+static int32_t min_scalar (const int32_t* src, uint32_t n)
+{
+    int32_t m = src[0];
+    uint32_t i;
+
+    for (i = 1; i < n; i++) {
+        if (src[i] < m) {
+            m = src[i];
+        }
+    }
+
+    return m;
+}
+
+static int32_t max_scalar (const int32_t* src, uint32_t n)
+{
+    int32_t m = src[0];
+    uint32_t i;
+
+    for (i = 1; i < n; i++) {
+        if (src[i] > m) {
+            m = src[i];
+        }
+    }
+
+    return m;
+}
+
+static uint32_t count_scalar (const int32_t* src, uint32_t n, int32_t x)
+{
+    uint32_t cnt = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        cnt += (src[i] == x);
+    }
+
+    return cnt;
+}
+
+// Index of the first differing byte, n if there is none.
+static uint32_t mismatch_scalar (const uint8_t* a, const uint8_t* b, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n && a[i] == b[i]; i++) {
+    }
+
+    return i;
+}
+
+// Offset of the first match of needle in hay, -1 if there is none.
+static int32_t search_scalar (const uint8_t* hay, uint32_t n, const uint8_t* needle, uint32_t m)
+{
+    uint32_t i;
+
+    if (m > n) {
+        return -1;
+    }
+
+    for (i = 0; i + m <= n; i++) {
+        if (mismatch_scalar(hay + i, needle, m) == m) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+// SSE2 has no 32-bit multiply low, min or max, so build them.
+__attribute__((target("sse2")))
+static inline __m128i mullo_sse2 (__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i min_sse2 (__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i max_sse2 (__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2 (int32_t* dst, uint32_t n, int32_t x)
+{
+    __m128i v = _mm_set1_epi32(x);
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+
+    fill_scalar(dst + i, n - i, x);
+}
+
+__attribute__((target("sse2")))
+static int32_t sum_sse2 (const int32_t* src, uint32_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int32_t lanes[4];
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        acc = _mm_add_epi32(acc, _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, acc);
+
+    return (int32_t)((uint32_t)sum_scalar(lanes, 4) + (uint32_t)sum_scalar(src + i, n - i));
+}
+
+__attribute__((target("sse2")))
+static void add_sse2 (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(va, vb));
+    }
+
+    add_scalar(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void mul_sse2 (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        _mm_storeu_si128((__m128i*)(dst + i), mullo_sse2(va, vb));
+    }
+
+    mul_scalar(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static int32_t dot_sse2 (const int32_t* a, const int32_t* b, uint32_t n)
+{
+    __m128i acc = _mm_setzero_si128();
+    int32_t lanes[4];
+    uint32_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+
+        acc = _mm_add_epi32(acc, mullo_sse2(va, vb));
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, acc);
+
+    return (int32_t)((uint32_t)sum_scalar(lanes, 4) + (uint32_t)dot_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("sse2")))
+static int32_t min_sse2_array (const int32_t* src, uint32_t n)
+{
+    __m128i m;
+    int32_t lanes[4];
+    int32_t tail;
+    uint32_t i;
+
+    if (n < 4) {
+        return min_scalar(src, n);
+    }
+
+    m = _mm_loadu_si128((const __m128i*)src);
+    for (i = 4; i + 4 <= n; i += 4) {
+        m = min_sse2(m, _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, m);
+    tail = min_scalar(lanes, 4);
+
+    if (i < n) {
+        int32_t rest = min_scalar(src + i, n - i);
+        tail = (rest < tail) ? rest : tail;
+    }
+
+    return tail;
+}
+
+__attribute__((target("sse2")))
+static int32_t max_sse2_array (const int32_t* src, uint32_t n)
+{
+    __m128i m;
+    int32_t lanes[4];
+    int32_t tail;
+    uint32_t i;
+
+    if (n < 4) {
+        return max_scalar(src, n);
+    }
+
+    m = _mm_loadu_si128((const __m128i*)src);
+    for (i = 4; i + 4 <= n; i += 4) {
+        m = max_sse2(m, _mm_loadu_si128((const __m128i*)(src + i)));
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, m);
+    tail = max_scalar(lanes, 4);
+
+    if (i < n) {
+        int32_t rest = max_scalar(src + i, n - i);
+        tail = (rest > tail) ? rest : tail;
+    }
+
+    return tail;
+}
+
+__attribute__((target("sse2")))
+static uint32_t count_sse2 (const int32_t* src, uint32_t n, int32_t x)
+{
+    __m128i v = _mm_set1_epi32(x);
+    __m128i acc = _mm_setzero_si128();
+    int32_t lanes[4];
+    uint32_t i;
+
+    // Equal lanes are -1, so subtracting the mask counts them.
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(src + i)), v);
+        acc = _mm_sub_epi32(acc, eq);
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, acc);
+
+    return (uint32_t)sum_scalar(lanes, 4) + count_scalar(src + i, n - i, x);
+}
+
+__attribute__((target("sse2")))
+static uint32_t mismatch_sse2 (const uint8_t* a, const uint8_t* b, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                    _mm_loadu_si128((const __m128i*)(b + i)));
+        uint32_t diff = (uint32_t)_mm_movemask_epi8(eq) ^ 0xffff;
+
+        if (diff != 0) {
+            return i + __builtin_ctz(diff);
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+// Candidates are positions where both the first and the last byte of the
+// needle match, 16 at a time; only those get a full compare.
+__attribute__((target("sse2")))
+static int32_t search_sse2 (const uint8_t* hay, uint32_t n, const uint8_t* needle, uint32_t m)
+{
+    __m128i first;
+    __m128i last;
+    uint32_t i;
+    int32_t rest;
+
+    if (m == 0 || m > n) {
+        return (m == 0) ? 0 : -1;
+    }
+
+    first = _mm_set1_epi8((char)needle[0]);
+    last = _mm_set1_epi8((char)needle[m - 1]);
+
+    for (i = 0; i + m - 1 + 16 <= n; i += 16) {
+        __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(hay + i)), first);
+        __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(hay + i + m - 1)), last);
+        uint32_t cand = (uint32_t)_mm_movemask_epi8(_mm_and_si128(f, l));
+
+        while (cand != 0) {
+            uint32_t at = i + __builtin_ctz(cand);
+
+            if (mismatch_sse2(hay + at, needle, m) == m) {
+                return at;
+            }
+
+            cand &= cand - 1;
+        }
+    }
+
+    rest = search_scalar(hay + i, n - i, needle, m);
+
+    return (rest < 0) ? -1 : (int32_t)i + rest;
+}
+
+
+__attribute__((target("avx2")))
+static void fill_avx2 (int32_t* dst, uint32_t n, int32_t x)
+{
+    __m256i v = _mm256_set1_epi32(x);
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+    }
+
+    fill_scalar(dst + i, n - i, x);
+}
+
+__attribute__((target("avx2")))
+static int32_t sum_avx2 (const int32_t* src, uint32_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int32_t lanes[8];
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc = _mm256_add_epi32(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+
+    return (int32_t)((uint32_t)sum_scalar(lanes, 8) + (uint32_t)sum_scalar(src + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static void add_avx2 (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(va, vb));
+    }
+
+    add_scalar(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mul_avx2 (const int32_t* a, const int32_t* b, int32_t* dst, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_mullo_epi32(va, vb));
+    }
+
+    mul_scalar(a + i, b + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_avx2 (const int32_t* a, const int32_t* b, uint32_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int32_t lanes[8];
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(va, vb));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+
+    return (int32_t)((uint32_t)sum_scalar(lanes, 8) + (uint32_t)dot_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static int32_t min_avx2 (const int32_t* src, uint32_t n)
+{
+    __m256i m;
+    int32_t lanes[8];
+    int32_t tail;
+    uint32_t i;
+
+    if (n < 8) {
+        return min_scalar(src, n);
+    }
+
+    m = _mm256_loadu_si256((const __m256i*)src);
+    for (i = 8; i + 8 <= n; i += 8) {
+        m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i*)(src + i)));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, m);
+    tail = min_scalar(lanes, 8);
+
+    if (i < n) {
+        int32_t rest = min_scalar(src + i, n - i);
+        tail = (rest < tail) ? rest : tail;
+    }
+
+    return tail;
+}
+
+__attribute__((target("avx2")))
+static int32_t max_avx2 (const int32_t* src, uint32_t n)
+{
+    __m256i m;
+    int32_t lanes[8];
+    int32_t tail;
+    uint32_t i;
+
+    if (n < 8) {
+        return max_scalar(src, n);
+    }
+
+    m = _mm256_loadu_si256((const __m256i*)src);
+    for (i = 8; i + 8 <= n; i += 8) {
+        m = _mm256_max_epi32(m, _mm256_loadu_si256((const __m256i*)(src + i)));
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, m);
+    tail = max_scalar(lanes, 8);
+
+    if (i < n) {
+        int32_t rest = max_scalar(src + i, n - i);
+        tail = (rest > tail) ? rest : tail;
+    }
+
+    return tail;
+}
+
+__attribute__((target("avx2")))
+static uint32_t count_avx2 (const int32_t* src, uint32_t n, int32_t x)
+{
+    __m256i v = _mm256_set1_epi32(x);
+    __m256i acc = _mm256_setzero_si256();
+    int32_t lanes[8];
+    uint32_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), v);
+        acc = _mm256_sub_epi32(acc, eq);
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+
+    return (uint32_t)sum_scalar(lanes, 8) + count_scalar(src + i, n - i, x);
+}
+
+__attribute__((target("avx2")))
+static uint32_t mismatch_avx2 (const uint8_t* a, const uint8_t* b, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                       _mm256_loadu_si256((const __m256i*)(b + i)));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(eq);
+
+        if (diff != 0) {
+            return i + __builtin_ctz(diff);
+        }
+    }
+
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int32_t search_avx2 (const uint8_t* hay, uint32_t n, const uint8_t* needle, uint32_t m)
+{
+    __m256i first;
+    __m256i last;
+    uint32_t i;
+    int32_t rest;
+
+    if (m == 0 || m > n) {
+        return (m == 0) ? 0 : -1;
+    }
+
+    first = _mm256_set1_epi8((char)needle[0]);
+    last = _mm256_set1_epi8((char)needle[m - 1]);
+
+    for (i = 0; i + m - 1 + 32 <= n; i += 32) {
+        __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(hay + i)), first);
+        __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(hay + i + m - 1)), last);
+        uint32_t cand = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(f, l));
+
+        while (cand != 0) {
+            uint32_t at = i + __builtin_ctz(cand);
+
+            if (mismatch_avx2(hay + at, needle, m) == m) {
+                return at;
+            }
+
+            cand &= cand - 1;
+        }
+    }
+
+    rest = search_scalar(hay + i, n - i, needle, m);
+
+    return (rest < 0) ? -1 : (int32_t)i + rest;
+}
+
+
+vector_ops vec = {
+    fill_scalar, sum_scalar, add_scalar, mul_scalar,
+    dot_scalar, min_scalar, max_scalar, count_scalar,
+    mismatch_scalar, search_scalar
+};
+
+void init_vector_ops (void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        vector_ops avx2 = {
+            fill_avx2, sum_avx2, add_avx2, mul_avx2,
+            dot_avx2, min_avx2, max_avx2, count_avx2,
+            mismatch_avx2, search_avx2
+        };
+        vec = avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        vector_ops sse2 = {
+            fill_sse2, sum_sse2, add_sse2, mul_sse2,
+            dot_sse2, min_sse2_array, max_sse2_array, count_sse2,
+            mismatch_sse2, search_sse2
+        };
+        vec = sse2;
+    }
+}
+
+
+// Bulk words.  Counts are in cells, not bytes.
+
+void* atom_fill (void)      // ( addr n x -- )
+{
+    int32_t x = (int32_t)pop_d();
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+
+    vec.fill(addr, n, x);
+
+    print_fn(atom_fill);
+    return next();
+}
+
+void* atom_move (void)      // ( src dst n -- )
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* dst = (int32_t*)pop_d();
+    int32_t* src = (int32_t*)pop_d();
+
+    memmove(dst, src, n * 4);
+
+    print_fn(atom_move);
+    return next();
+}
+
+void* atom_sum (void)       // ( addr n -- x )
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+
+    push_d(vec.sum(addr, n));
+
+    print_fn(atom_sum);
+    return next();
+}
+
+void* atom_vadd (void)      // ( a b dst n -- )
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* dst = (int32_t*)pop_d();
+    int32_t* b = (int32_t*)pop_d();
+    int32_t* a = (int32_t*)pop_d();
+
+    vec.add(a, b, dst, n);
+
+    print_fn(atom_vadd);
+    return next();
+}
+
+void* atom_vmul (void)      // ( a b dst n -- )
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* dst = (int32_t*)pop_d();
+    int32_t* b = (int32_t*)pop_d();
+    int32_t* a = (int32_t*)pop_d();
+
+    vec.mul(a, b, dst, n);
+
+    print_fn(atom_vmul);
+    return next();
+}
+
+void* atom_dot (void)       // ( a b n -- x )
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* b = (int32_t*)pop_d();
+    int32_t* a = (int32_t*)pop_d();
+
+    push_d(vec.dot(a, b, n));
+
+    print_fn(atom_dot);
+    return next();
+}
+
+void* atom_vmin (void)      // ( addr n -- x ), 0 for an empty array
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+
+    push_d((n > 0) ? vec.min(addr, n) : 0);
+
+    print_fn(atom_vmin);
+    return next();
+}
+
+void* atom_vmax (void)      // ( addr n -- x ), 0 for an empty array
+{
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+
+    push_d((n > 0) ? vec.max(addr, n) : 0);
+
+    print_fn(atom_vmax);
+    return next();
+}
+
+void* atom_vcount (void)    // ( addr n x -- count ), cells equal to x
+{
+    int32_t x = (int32_t)pop_d();
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+
+    push_d(vec.count(addr, n, x));
+
+    print_fn(atom_vcount);
+    return next();
+}
+
+
+// Strings are ( addr len ) slices.  s" in a definition compiles the
+// characters inline after sliteral and a length cell, so the slice points
+// straight into the body.  Interpreted, the characters are copied to
+// string_buffer, which only holds the latest one.
+
+char string_buffer[INPUT_BUFFER_SIZE];
+
+bool compile_string (const char* str, uint32_t len)
+{
+    if (!arena_room(8 + (int64_t)((len + 3) & ~3))) {
+        return false;
+    }
+
+    *(fword*)here = atom_sliteral;
+    here += 4;
+    *(uint32_t*)here = len;
+    here += 4;
+
+    memcpy(here, str, len);
+    memset(here + len, 0, -len & 3);
+    here += (len + 3) & ~3;
+
+    return true;
+}
+
+void* atom_sliteral (void)
+{
+    uint32_t len = (uint32_t)*i_ptr;
+
+    push_d((intptr_t)(i_ptr + 1));
+    push_d(len);
+
+    i_ptr += 1 + (len + 3) / 4;
+
+    print_fn(atom_sliteral);
+    return next();
+}
+
+void* atom_squote (void)    // s" text" ( -- addr len )
+{
+    uint32_t len;
+    char* str = parse('"', &len);
+
+    if (compile_mode) {
+        if (!compile_string(str, len)) {
+            return pino_throw(THROW_DICT_OVERFLOW);
+        }
+    } else {
+        memcpy(string_buffer, str, len);
+        push_d((intptr_t)string_buffer);
+        push_d(len);
+    }
+
+    print_fn(atom_squote);
+    return next();
+}
+
+void* atom_dotquote (void)  // ." text"
+{
+    uint32_t len;
+    char* str = parse('"', &len);
+
+    if (compile_mode) {
+        if (!compile_string(str, len) || !arena_room(4)) {
+            return pino_throw(THROW_DICT_OVERFLOW);
+        }
+
+        *(fword*)here = atom_type;
+        here += 4;
+    } else {
+        out_write(str, len);
+    }
+
+    print_fn(atom_dotquote);
+    return next();
+}
+
+void* atom_type (void)      // ( addr len -- )
+{
+    uint32_t len = (uint32_t)pop_d();
+    char* addr = (char*)pop_d();
+
+    out_write(addr, len);
+
+    print_fn(atom_type);
+    return next();
+}
+
+void* atom_emit (void)      // ( c -- )
+{
+    char c = (char)pop_d();
+
+    out_write(&c, 1);
+
+    print_fn(atom_emit);
+    return next();
+}
+
+void* atom_print (void)     // . ( n -- )
+{
+    out_printf("%d ", (int)pop_d());
+
+    print_fn(atom_print);
+    return next();
+}
+
+void* atom_cr (void)
+{
+    out_write("\n", 1);
+
+    print_fn(atom_cr);
+    return next();
+}
+
+void* atom_flush (void)
+{
+    out_flush();
+
+    print_fn(atom_flush);
+    return next();
+}
+
+void* atom_compare (void)   // ( a1 u1 a2 u2 -- n ), -1, 0 or 1
+{
+    uint32_t u2 = (uint32_t)pop_d();
+    uint8_t* a2 = (uint8_t*)pop_d();
+    uint32_t u1 = (uint32_t)pop_d();
+    uint8_t* a1 = (uint8_t*)pop_d();
+    uint32_t n = (u1 < u2) ? u1 : u2;
+    uint32_t at = vec.mismatch(a1, a2, n);
+
+    if (at < n) {
+        push_d((a1[at] < a2[at]) ? -1 : 1);
+    } else {
+        push_d((u1 < u2) ? -1 : (u1 > u2));
+    }
+
+    print_fn(atom_compare);
+    return next();
+}
+
+// ( a1 u1 a2 u2 -- a3 u3 flag ), on a match a3 u3 is the rest of the
+// first string from there, otherwise it is left as it was.
+void* atom_search (void)
+{
+    uint32_t u2 = (uint32_t)pop_d();
+    uint8_t* a2 = (uint8_t*)pop_d();
+    uint32_t u1 = (uint32_t)data_stack[tods];
+    uint8_t* a1 = (uint8_t*)data_stack[tods - 1];
+    int32_t at = vec.search(a1, u1, a2, u2);
+
+    if (at >= 0) {
+        data_stack[tods - 1] = (uintptr_t)(a1 + at);
+        data_stack[tods] = u1 - at;
+    }
+
+    push_d((at >= 0) ? -1 : 0);
+
+    print_fn(atom_search);
+    return next();
+}
+
+void* atom_hash (void)      // ( addr len -- h ), 32-bit FNV-1a
+{
+    uint32_t len = (uint32_t)pop_d();
+    uint8_t* addr = (uint8_t*)data_stack[tods];
+    uint32_t h = 2166136261u;
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ addr[i]) * 16777619u;
+    }
+
+    data_stack[tods] = h;
+
+    print_fn(atom_hash);
+    return next();
+}
+
+
+// File words.  Files are plain descriptors and an ior is 0 or -errno.
+// Names are ( addr len ) slices, e.g. from s".
+
+void* atom_ro (void)
+{
+    push_d(O_RDONLY);
+
+    print_fn(atom_ro);
+    return next();
+}
+
+void* atom_wo (void)
+{
+    push_d(O_WRONLY);
+
+    print_fn(atom_wo);
+    return next();
+}
+
+void* atom_rw (void)
+{
+    push_d(O_RDWR);
+
+    print_fn(atom_rw);
+    return next();
+}
+
+static void file_open (int flags)  // ( addr len fam -- fd ior )
+{
+    int fam = (int)pop_d();
+    uint32_t len = (uint32_t)pop_d();
+    char* name = (char*)pop_d();
+    char path[INPUT_BUFFER_SIZE];
+    int fd;
+
+    if (len >= sizeof(path)) {
+        push_d(-1);
+        push_d(-ENAMETOOLONG);
+        return;
+    }
+
+    memcpy(path, name, len);
+    path[len] = '\0';
+
+    fd = open(path, (fam & O_ACCMODE) | flags, 0644);
+
+    push_d(fd);
+    push_d((fd < 0) ? -errno : 0);
+}
+
+void* atom_open_file (void)
+{
+    file_open(0);
+
+    print_fn(atom_open_file);
+    return next();
+}
+
+void* atom_create_file (void)
+{
+    file_open(O_CREAT | O_TRUNC);
+
+    print_fn(atom_create_file);
+    return next();
+}
+
+void* atom_read_file (void)     // ( addr u fd -- u2 ior )
+{
+    int fd = (int)pop_d();
+    uint32_t len = (uint32_t)pop_d();
+    void* addr = (void*)pop_d();
+    ssize_t got = read(fd, addr, len);
+
+    push_d((got < 0) ? 0 : got);
+    push_d((got < 0) ? -errno : 0);
+
+    print_fn(atom_read_file);
+    return next();
+}
+
+void* atom_write_file (void)    // ( addr u fd -- ior )
+{
+    int fd = (int)pop_d();
+    uint32_t len = (uint32_t)pop_d();
+    uint8_t* addr = (uint8_t*)pop_d();
+    int ior = 0;
+
+    while (len > 0) {
+        ssize_t put = write(fd, addr, len);
+
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            ior = -errno;
+            break;
+        }
+
+        addr += put;
+        len -= put;
+    }
+
+    push_d(ior);
+
+    print_fn(atom_write_file);
+    return next();
+}
+
+void* atom_close_file (void)    // ( fd -- ior )
+{
+    int fd = (int)pop_d();
+
+    push_d((close(fd) < 0) ? -errno : 0);
+
+    print_fn(atom_close_file);
+    return next();
+}
+
+
+// Asynchronous reads and writes at a file offset.  aread and awrite
+// return a request handle right away; await blocks until it completes
+// and frees it, apoll only checks.  Requests go through an io_uring set
+// up on first use, or a few I/O threads doing pread/pwrite where
+// io_uring isn't available.  The buffer must stay put until the request
+// completes.  The offset is one unsigned cell, so only the first 4 GB of
+// a file can be reached.  async_lock covers the request slots and both
+// rings, so par-map workers can start and wait on requests too.
+
+#define ASYNC_MAX_REQUESTS  64      // Also the io_uring depth
+#define ASYNC_THREADS       4
+
+enum { ASYNC_FREE, ASYNC_PENDING, ASYNC_DONE };
+
+typedef struct {
+    uint8_t* buf;
+    uint32_t len;
+    uint32_t offset;        // 32 bits: first 4 GB only
+    int fd;
+    bool write;
+    int32_t result;         // Bytes moved, or -errno
+    int state;
+} async_request;
+
+async_request async_requests[ASYNC_MAX_REQUESTS];
+
+enum { ASYNC_NONE, ASYNC_URING, ASYNC_POOL } async_backend;
+
+// io_uring
+int uring_fd = -1;
+uint32_t* sq_head;
+uint32_t* sq_tail;
+uint32_t* sq_mask;
+uint32_t* sq_array;
+uint32_t* cq_head;
+uint32_t* cq_tail;
+uint32_t* cq_mask;
+struct io_uring_sqe* sqes;
+struct io_uring_cqe* cqes;
+
+// Thread pool fallback.  Requests wait in a ring of indices.
+int async_queue[ASYNC_MAX_REQUESTS];
+unsigned int async_queue_head;
+unsigned int async_queue_tail;
+pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t async_queued = PTHREAD_COND_INITIALIZER;
+pthread_cond_t async_done = PTHREAD_COND_INITIALIZER;
+
+static bool uring_init (void)
+{
+    struct io_uring_params p;
+    uint8_t* sq;
+    uint8_t* cq;
+    size_t sq_size;
+    size_t cq_size;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+
+    fd = syscall(SYS_io_uring_setup, ASYNC_MAX_REQUESTS, &p);
+    if (fd < 0) {
+        return false;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+    }
+
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+    }
+
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    sq_head = (uint32_t*)(sq + p.sq_off.head);
+    sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+    sq_mask = (uint32_t*)(sq + p.sq_off.ring_mask);
+    sq_array = (uint32_t*)(sq + p.sq_off.array);
+    cq_head = (uint32_t*)(cq + p.cq_off.head);
+    cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+    cq_mask = (uint32_t*)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    uring_fd = fd;
+    return true;
+}
+
+// Every request is submitted as soon as it is made, and there are never
+// more in flight than SQ entries, so the SQ can't be full here.  If the
+// kernel didn't take the SQE, the tail is rolled back so it isn't sent
+// later under a freed (and maybe reused) slot.  Called with async_lock
+// held, like uring_reap().
+static bool uring_submit (int idx)
+{
+    async_request* req = &async_requests[idx];
+    uint32_t tail = *sq_tail;
+    uint32_t slot = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->off = req->offset;
+    sqe->addr = (uintptr_t)req->buf;
+    sqe->len = req->len;
+    sqe->user_data = idx;
+
+    sq_array[slot] = slot;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(SYS_io_uring_enter, uring_fd, 1, 0, 0, NULL, 0) == 1) {
+        return true;
+    }
+
+    if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) != tail) {
+        return true;    // Consumed after all; it completes through the CQ
+    }
+
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+}
+
+static void uring_reap (void)
+{
+    uint32_t head = *cq_head;
+    uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        async_request* req = &async_requests[cqe->user_data];
+
+        req->result = cqe->res;
+        req->state = ASYNC_DONE;
+        head++;
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void* async_worker (void* arg)
+{
+    (void)arg;
+
+    while (1) {
+        async_request* req;
+        ssize_t moved;
+
+        pthread_mutex_lock(&async_lock);
+        while (async_queue_head == async_queue_tail) {
+            pthread_cond_wait(&async_queued, &async_lock);
+        }
+        req = &async_requests[async_queue[async_queue_head++ % ASYNC_MAX_REQUESTS]];
+        pthread_mutex_unlock(&async_lock);
+
+        if (req->write) {
+            moved = pwrite(req->fd, req->buf, req->len, req->offset);
+        } else {
+            moved = pread(req->fd, req->buf, req->len, req->offset);
+        }
+
+        pthread_mutex_lock(&async_lock);
+        req->result = (moved < 0) ? -errno : moved;
+        req->state = ASYNC_DONE;
+        pthread_cond_broadcast(&async_done);
+        pthread_mutex_unlock(&async_lock);
+    }
+
+    return NULL;
+}
+
+// Called with async_lock held.
+static bool async_init (void)
+{
+    int started = 0;
+    int idx;
+
+    if (async_backend != ASYNC_NONE) {
+        return true;
+    }
+
+    if (uring_init()) {
+        async_backend = ASYNC_URING;
+        return true;
+    }
+
+    for (idx = 0; idx < ASYNC_THREADS; idx++) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, async_worker, NULL) == 0) {
+            pthread_detach(thread);
+            started++;
+        }
+    }
+
+    if (started == 0) {
+        return false;
+    }
+
+    async_backend = ASYNC_POOL;
+    return true;
+}
+
+// ( addr u fd offset -- req ), 0 if it couldn't be started.
+static void* async_start (bool write)
+{
+    uint32_t offset = (uint32_t)pop_d();
+    int fd = (int)pop_d();
+    uint32_t len = (uint32_t)pop_d();
+    uint8_t* buf = (uint8_t*)pop_d();
+    async_request* req = NULL;
+    int idx;
+
+    pthread_mutex_lock(&async_lock);
+
+    if (!async_init()) {
+        pthread_mutex_unlock(&async_lock);
+        return pino_throw(THROW_UNSUPPORTED);
+    }
+
+    for (idx = 0; idx < ASYNC_MAX_REQUESTS; idx++) {
+        if (async_requests[idx].state == ASYNC_FREE) {
+            req = &async_requests[idx];
+            break;
+        }
+    }
+
+    if (req == NULL) {
+        pthread_mutex_unlock(&async_lock);
+        push_d(0);
+        return next();
+    }
+
+    req->buf = buf;
+    req->len = len;
+    req->offset = offset;
+    req->fd = fd;
+    req->write = write;
+    req->result = 0;
+    req->state = ASYNC_PENDING;
+
+    if (async_backend == ASYNC_URING) {
+        if (!uring_submit(idx)) {
+            req->state = ASYNC_FREE;
+            idx = -1;
+        }
+    } else {
+        async_queue[async_queue_tail++ % ASYNC_MAX_REQUESTS] = idx;
+        pthread_cond_signal(&async_queued);
+    }
+
+    pthread_mutex_unlock(&async_lock);
+
+    push_d(idx + 1);
+    return next();
+}
+
+void* atom_aread (void)
+{
+    print_fn(atom_aread);
+    return async_start(false);
+}
+
+void* atom_awrite (void)
+{
+    print_fn(atom_awrite);
+    return async_start(true);
+}
+
+static async_request* pop_request (void)
+{
+    uint32_t handle = (uint32_t)pop_d();
+    bool unused;
+
+    if (handle == 0 || handle > ASYNC_MAX_REQUESTS) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&async_lock);
+    unused = (async_requests[handle - 1].state == ASYNC_FREE);
+    pthread_mutex_unlock(&async_lock);
+
+    return unused ? NULL : &async_requests[handle - 1];
+}
+
+static bool async_is_done (async_request* req)
+{
+    bool done;
+
+    pthread_mutex_lock(&async_lock);
+    if (async_backend == ASYNC_URING) {
+        uring_reap();
+    }
+    done = (req->state == ASYNC_DONE);
+    pthread_mutex_unlock(&async_lock);
+
+    return done;
+}
+
+void* atom_await (void)     // ( req -- u ior )
+{
+    async_request* req = pop_request();
+
+    print_fn(atom_await);
+
+    if (req == NULL) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
+
+    if (async_backend == ASYNC_URING) {
+        while (!async_is_done(req)) {
+            syscall(SYS_io_uring_enter, uring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        }
+    } else {
+        pthread_mutex_lock(&async_lock);
+        while (req->state != ASYNC_DONE) {
+            pthread_cond_wait(&async_done, &async_lock);
+        }
+        pthread_mutex_unlock(&async_lock);
+    }
+
+    push_d((req->result < 0) ? 0 : req->result);
+    push_d((req->result < 0) ? req->result : 0);
+
+    pthread_mutex_lock(&async_lock);
+    req->state = ASYNC_FREE;
+    pthread_mutex_unlock(&async_lock);
+
+    return next();
+}
+
+void* atom_apoll (void)     // ( req -- flag ), true once it has completed
+{
+    async_request* req = pop_request();
+
+    print_fn(atom_apoll);
+
+    if (req == NULL) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
+
+    push_d(async_is_done(req) ? -1 : 0);
+
+    return next();
+}
+
+
+void* atom_if (void)
+{
+    char msg[40];
+
+    if (!arena_room(8)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    // Compile atom_jmp0 to *here
+    // here += 4
+    *(fword*)here = atom_jmp0;
+    here += 4;
+
+    // push_ds(here)
+    sprintf(msg, "push %p on stack", here);
+    push_d((intptr_t)here);
+
+    here += 4;
+
+    print_fn_msg(atom_if, msg);
+
+    return next();
+}
+
+void* atom_else (void)
+{
+    uint8_t* tmp;
+    int32_t offset;
+    char msg[40];
+
+    if (!arena_room(8)) {
+        return pino_throw(THROW_DICT_OVERFLOW);
+    }
+
+    // Compile atom_jmp to *here
+    // here += 4
+    *(fword*)here = atom_jmp;
+    here += 4;
+
+    tmp = (uint8_t*)pop_d();
+
+    // Store address for previous 'if'
+    offset = (int32_t)(here - tmp);
+    *(int32_t*)tmp = offset;
+
+    sprintf(msg, "fill %d, push %p", offset, here);
+    push_d((intptr_t)here);
+
+    here += 4;
+
+    print_fn_msg(atom_else, msg);
+
+    return next();
+}
+
+void* atom_then (void)
+{
+    uint8_t* tmp;
+    int32_t offset;
+    char msg[40];
+
+    // Pop the address to be filled from the stack
+    tmp = (uint8_t*)pop_d();
+
+    // Store address for previous 'if' or 'else'
+    offset = (int32_t)(here - tmp - 4);
+    *(int32_t*)tmp = offset;
+
+    sprintf(msg, "fill %d in", offset);
+    print_fn_msg(atom_then, msg);
+
+    return next();
+}
+
+char* find_word (char* word_to_find, uint8_t* flags)
+{
+    word_header* cur = find_header(word_to_find);
+
+    if (cur == NULL) {
+        return NULL;
+    }
+
+    *flags = cur->flags;
+    return (char*)cur->body;
+}
+
+
+// How the cell(s) following a primitive in a threaded body are used.
+typedef enum {
+    OPERAND_NONE,       // No inline operand
+    OPERAND_LIT,        // One literal value
+    OPERAND_BRANCH,     // One byte offset, relative to the following cell
+    OPERAND_CELL,       // One raw cell (e.g. a word to compile)
+    OPERAND_STRING,     // A length cell, then the characters padded to a cell
+} operand_kind;
+
+typedef struct {
+    fword fn;
+    operand_kind operand;
+    const char* c_code;     // Inline C for --emit-c, NULL if not translatable
+} prim_info;
+
+// The C snippets run against the TOS/NOS/PUSH/POP macros in the emitted
+// prelude.  A single %d is replaced with the literal value, or with the
+// label number of the branch target.
+prim_info prim_table[] = {
+    {atom_bye,          OPERAND_NONE,   "exit(0);"},
+    {atom_dup,          OPERAND_NONE,   "PUSH(TOS);"},
+    {atom_swap,         OPERAND_NONE,   "{ uintptr_t t = TOS; TOS = NOS; NOS = t; }"},
+    {atom_drop,         OPERAND_NONE,   "tods--;"},
+    {atom_not,          OPERAND_NONE,   "TOS = !TOS;"},
+    {atom_plus,         OPERAND_NONE,   "{ int a = (int)POP(); TOS = (uintptr_t)(intptr_t)((int)TOS + a); }"},
+    {atom_nop,          OPERAND_NONE,   ";"},
+    {atom_exit,         OPERAND_NONE,   "return;"},
+    {atom_literal,      OPERAND_LIT,    "PUSH((intptr_t)%d);"},
+    {atom_jmp,          OPERAND_BRANCH, "goto L%d;"},
+    {atom_jmp0,         OPERAND_BRANCH, "if (POP() == 0) goto L%d;"},
+    {atom_1compile1,    OPERAND_CELL,   NULL},
+    {atom_lit_plus,     OPERAND_LIT,    "TOS = (uintptr_t)(intptr_t)((int)TOS + %d);"},
+    {atom_jmpnz,        OPERAND_BRANCH, "if (POP() != 0) goto L%d;"},
+    {atom_nip,          OPERAND_NONE,   "NOS = TOS; tods--;"},
+    {atom_sliteral,     OPERAND_STRING, "PUSH(s); PUSH(%d);"},
+    {atom_type,         OPERAND_NONE,   "{ uint32_t n = (uint32_t)POP(); fwrite((const void*)POP(), 1, n, stdout); }"},
+    {atom_emit,         OPERAND_NONE,   "putchar((int)POP());"},
+    {atom_print,        OPERAND_NONE,   "printf(\"%%d \", (int)POP());"},
+    {atom_cr,           OPERAND_NONE,   "putchar('\\n');"},
+    {NULL,              OPERAND_NONE,   NULL}
+};
+
+prim_info* find_prim_info (fword fn)
+{
+    prim_info* info;
+
+    for (info = prim_table; info->fn != NULL; info++) {
+        if (info->fn == fn) {
+            return info;
+        }
+    }
+
+    return NULL;
+}
+
+
+// One decoded instruction of a user word body.
+typedef struct {
+    fword fn;           // Primitive, or NULL for a call to a user word
+    uint8_t* callee;    // Body of the called user word
+    int32_t arg;        // Inline operand, if any
+    uint8_t* data;      // Characters of a string operand
+    int target;         // Op index of the branch target, -1 if none
+    uint32_t offset;    // Cell offset of the op within the body
+} body_op;
+
+#define MAX_BODY_OPS    1024
+
+// Tiered execution.  With --tier-threshold N each call of a user word
+// bumps the counter cell ahead of its body, and the Nth call promotes the
+// word: the body is rebuilt in tier_arena with small callees inlined and
+// common primitive pairs fused, then the first two cells of the original
+// body are patched into a jmp to the new code.  Redefining the word, or a
+// word inlined into it, puts the original cells back.
+
+#define TIER_ARENA_SIZE     (256 * 1024)
+#define TIER_MAX_WORDS      1024
+#define TIER_INLINE_OPS     16      // Largest callee body that gets inlined
+#define TIER_MAX_INLINED    32
+#define TIER_RETRY          64      // Calls to wait when promotion is deferred
+
+typedef struct {
+    uint8_t* body;          // Original body, starts with a jmp while active
+    uint8_t* opt;           // Optimized body in tier_arena
+    fword saved[2];         // Original first two cells
+    uint8_t* inlined[TIER_MAX_INLINED];
+    int num_inlined;
+    bool active;
+} tier_record;
+
+alignas(8) uint8_t tier_arena[TIER_ARENA_SIZE];
+uint8_t* tier_here = tier_arena;
+tier_record tier_records[TIER_MAX_WORDS];
+int tier_num_records;
+
+// The body that actually runs for a user word.
+uint8_t* tier_resolve (uint8_t* body)
+{
+    int idx;
+
+    for (idx = 0; idx < tier_num_records; idx++) {
+        if (tier_records[idx].active && tier_records[idx].body == body) {
+            return tier_records[idx].opt;
+        }
+    }
+
+    return body;
+}
+
+
+// Decode a user word body into ops, resolving branch targets to op indices.
+// The body ends at the first exit or jmp not jumped over by a forward
+// branch; a word re-laid from a profile may end in a jmp back.
+// Promoted words decode their optimized body.
+// Returns the number of ops, or -1 if the body can't be decoded.
+int decode_body (uint8_t* body, body_op* ops, int max_ops)
+{
+    fword* cells;
+    uint8_t* end;
+    uint32_t pos = 0;
+    uint32_t limit = 0;     // Furthest cell reached by a forward branch
+    bool ended = false;
+    int n = 0;
+    int i, j;
+
+    body = tier_resolve(body);
+    cells = (fword*)body;
+    end = (body >= tier_arena && body < tier_arena + TIER_ARENA_SIZE) ? tier_here : here;
+
+    while (!ended && n < max_ops && body + pos * 4 < end) {
+        uintptr_t cell = (uintptr_t)cells[pos];
+        body_op* op = &ops[n++];
+        prim_info* info;
+
+        op->offset = pos;
+        op->target = -1;
+        op->arg = 0;
+        pos++;
+
+        if (cell & 0x01) {
+            op->fn = NULL;
+            op->callee = (uint8_t*)(cell - 1);
+            continue;
+        }
+
+        op->fn = (fword)cell;
+        op->callee = NULL;
+        info = find_prim_info(op->fn);
+
+        // Anything not in the table is an operand free native word.
+        if (info != NULL && info->operand != OPERAND_NONE) {
+            op->arg = (int32_t)(intptr_t)cells[pos];
+            pos++;
+
+            if (info->operand == OPERAND_STRING) {
+                op->data = (uint8_t*)&cells[pos];
+                pos += ((uint32_t)op->arg + 3) / 4;
+            }
+
+            if (info->operand == OPERAND_BRANCH) {
+                int32_t dest = (int32_t)pos + op->arg / 4;
+
+                if (dest < 0) {
+                    return -1;
+                }
+
+                // Hold the cell offset until all ops are known.
+                op->target = dest;
+                if ((uint32_t)dest > limit) {
+                    limit = dest;
+                }
+            }
+        }
+
+        if ((op->fn == atom_exit || op->fn == atom_jmp) && limit <= op->offset) {
+            ended = true;
+        }
+    }
+
+    if (!ended) {
+        return -1;
+    }
+
+    // Convert branch cell offsets to op indices.
+    for (i = 0; i < n; i++) {
+        if (ops[i].target < 0) {
+            continue;
+        }
+
+        for (j = 0; j < n; j++) {
+            if (ops[j].offset == (uint32_t)ops[i].target) {
+                break;
+            }
+        }
+
+        if (j == n) {
+            return -1;  // Jumps into the middle of an op.
+        }
+
+        ops[i].target = j;
+    }
+
+    return n;
+}
+
+
+// Decode a callee for inlining.  It must be small and only exit at its end.
+static int tier_inline_ops (uint8_t* callee, uint8_t* caller, body_op* ops)
+{
+    int n;
+    int i;
+
+    if (callee == caller) {
+        return -1;
+    }
+
+    n = decode_body(callee, ops, TIER_INLINE_OPS);
+    if (n < 0 || ops[n - 1].fn != atom_exit) {
+        return -1;
+    }
+
+    for (i = 0; i < n - 1; i++) {
+        if (ops[i].fn == atom_exit) {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+// Decode the body with inlinable calls replaced by the callee's ops.
+static int tier_inline (uint8_t* body, tier_record* rec, body_op* out)
+{
+    body_op* ops = malloc(MAX_BODY_OPS * sizeof(body_op));
+    body_op* callee_ops = malloc(TIER_INLINE_OPS * sizeof(body_op));
+    int* map = malloc(MAX_BODY_OPS * sizeof(int));
+    bool* from_caller = malloc(MAX_BODY_OPS * sizeof(bool));
+    int n = decode_body(body, ops, MAX_BODY_OPS);
+    int count = 0;
+    int i, j;
+
+    for (i = 0; i < n && count >= 0; i++) {
+        int k = -1;
+
+        map[i] = count;
+
+        if (ops[i].fn == NULL && rec->num_inlined < TIER_MAX_INLINED) {
+            k = tier_inline_ops(ops[i].callee, body, callee_ops);
+        }
+
+        if (k > 0 && count + k - 1 < MAX_BODY_OPS) {
+            // Drop the callee's exit.  Branches to it land on the next op.
+            rec->inlined[rec->num_inlined++] = ops[i].callee;
+
+            for (j = 0; j < k - 1; j++) {
+                out[count] = callee_ops[j];
+                if (out[count].target >= 0) {
+                    out[count].target += map[i];
+                }
+                from_caller[count++] = false;
+            }
+        } else if (count < MAX_BODY_OPS) {
+            out[count] = ops[i];
+            from_caller[count++] = true;
+        } else {
+            count = -1;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (from_caller[i] && out[i].target >= 0) {
+            out[i].target = map[out[i].target];
+        }
+    }
+
+    free(from_caller);
+    free(map);
+    free(callee_ops);
+    free(ops);
+
+    return (n < 0) ? -1 : count;
+}
+
+// Fuse primitive pairs into superinstructions, in place.  A pair is left
+// alone when its second op is a branch target.
+static int tier_fuse (body_op* ops, int n)
+{
+    bool* is_target = calloc(n, sizeof(bool));
+    int* map = malloc(n * sizeof(int));
+    int count = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (ops[i].target >= 0) {
+            is_target[ops[i].target] = true;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        body_op fused = ops[i];
+        fword second = (i + 1 < n && !is_target[i + 1]) ? ops[i + 1].fn : NULL;
+
+        map[i] = count;
+
+        if (ops[i].fn == atom_literal && second == atom_plus) {
+            fused.fn = atom_lit_plus;
+        } else if (ops[i].fn == atom_not && second == atom_jmp0) {
+            fused = ops[i + 1];
+            fused.fn = atom_jmpnz;
+        } else if (ops[i].fn == atom_swap && second == atom_drop) {
+            fused.fn = atom_nip;
+        } else {
+            second = NULL;
+        }
+
+        if (second != NULL) {
+            i++;
+            map[i] = count;
+        }
+
+        ops[count++] = fused;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (ops[i].target >= 0) {
+            ops[i].target = map[ops[i].target];
+        }
+    }
+
+    free(map);
+    free(is_target);
+
+    return count;
+}
+
+static inline uint32_t op_cells (body_op* op)
+{
+    prim_info* info = (op->fn != NULL) ? find_prim_info(op->fn) : NULL;
+
+    if (info == NULL || info->operand == OPERAND_NONE) {
+        return 1;
+    }
+
+    if (info->operand == OPERAND_STRING) {
+        return 2 + ((uint32_t)op->arg + 3) / 4;
+    }
+
+    return 2;
+}
+
+// Size in bytes of the ops laid out as threaded code.
+uint32_t ops_size (body_op* ops, int n)
+{
+    uint32_t cells = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        cells += op_cells(&ops[i]);
+    }
+
+    return cells * 4;
+}
+
+// Lay the ops out as threaded code at dst, the inverse of decode_body().
+// String operands may point into dst itself, so it is built aside first.
+void encode_ops (body_op* ops, int n, uint8_t* dst)
+{
+    uint32_t* pos = malloc((n + 1) * sizeof(uint32_t));
+    fword* cells;
+    int i;
+
+    pos[0] = 0;
+    for (i = 0; i < n; i++) {
+        pos[i + 1] = pos[i] + op_cells(&ops[i]);
+    }
+
+    cells = calloc(pos[n] + 1, sizeof(fword));
+
+    for (i = 0; i < n; i++) {
+        uint32_t at = pos[i];
+
+        if (ops[i].fn == NULL) {
+            cells[at] = (fword)((uint32_t)ops[i].callee | 0x01);
+        } else {
+            cells[at] = ops[i].fn;
+        }
+
+        if (op_cells(&ops[i]) >= 2) {
+            if (ops[i].target >= 0) {
+                int32_t offset = (int32_t)(pos[ops[i].target] - (at + 2)) * 4;
+                cells[at + 1] = (fword)(intptr_t)offset;
+            } else {
+                cells[at + 1] = (fword)(intptr_t)ops[i].arg;
+            }
+        }
+
+        if (pos[i + 1] - at > 2) {
+            memcpy(&cells[at + 2], ops[i].data, ops[i].arg);
+        }
+    }
+
+    memcpy(dst, cells, pos[n] * sizeof(fword));
+
+    free(cells);
+    free(pos);
+}
+
+static uint8_t* tier_emit (body_op* ops, int n, uint32_t* size)
+{
+    uint8_t* code = tier_here;
+
+    *size = ops_size(ops, n);
+    if (tier_here + *size > tier_arena + TIER_ARENA_SIZE) {
+        return NULL;
+    }
+
+    encode_ops(ops, n, code);
+    tier_here += *size;
+
+    return code;
+}
+
+void tier_promote (uint8_t* body)
+{
+    uint32_t* calls = (uint32_t*)body - 1;
+    uint32_t size = body_size(body);
+    tier_record* rec;
+    body_op* ops;
+    uint8_t* opt = NULL;
+    uint32_t opt_size;
+    unsigned int idx;
+    int inlined_n;
+    int n;
+
+    if (size < 8 || tier_num_records >= TIER_MAX_WORDS) {
+        return;
+    }
+
+    // Once patched, the old body only runs its first two cells.  Wait for
+    // any frame that would return into it to unwind.
+    for (idx = BASE_OF_STACK + 1; idx <= tors; idx++) {
+        uint8_t* ret = (uint8_t*)return_stack[idx];
+
+        if (ret > body && ret <= body + size) {
+            *calls = (tier_threshold > TIER_RETRY) ? tier_threshold - TIER_RETRY : 0;
+            return;
+        }
+    }
+
+    // Suspended coroutines hold frames of their own.
+    if (coro_holds(body, size)) {
+        *calls = (tier_threshold > TIER_RETRY) ? tier_threshold - TIER_RETRY : 0;
+        return;
+    }
+
+    rec = &tier_records[tier_num_records];
+    memset(rec, 0, sizeof(*rec));
+
+    ops = malloc(MAX_BODY_OPS * sizeof(body_op));
+    inlined_n = tier_inline(body, rec, ops);
+    n = (inlined_n > 0) ? tier_fuse(ops, inlined_n) : -1;
+
+    // Only worth a jmp if something changed.
+    if (n > 0 && (rec->num_inlined > 0 || n < inlined_n)) {
+        opt = tier_emit(ops, n, &opt_size);
+    }
+
+    free(ops);
+
+    if (opt == NULL) {
+        return;
+    }
+
+    rec->body = body;
+    rec->opt = opt;
+    rec->saved[0] = ((fword*)body)[0];
+    rec->saved[1] = ((fword*)body)[1];
+    rec->active = true;
+    tier_num_records++;
+
+    // The operand first, then the single cell that switches callers over.
+    ((fword*)body)[1] = (fword)(intptr_t)(opt - (body + 8));
+    __atomic_store_n((fword*)body, atom_jmp, __ATOMIC_RELEASE);
+
+    if (perf_map_enabled) {
+        char name[16];
+
+        snprintf(name, sizeof(name), "%s.opt", header_of(body)->name);
+        perf_map_word(opt, opt_size, name);
+    }
+}
+
+static void tier_deopt (tier_record* rec)
+{
+    __atomic_store_n((fword*)rec->body, rec->saved[0], __ATOMIC_RELEASE);
+    ((fword*)rec->body)[1] = rec->saved[1];
+    *((uint32_t*)rec->body - 1) = 0;
+    rec->active = false;
+}
+
+// Deoptimize every promoted word that is, or has inlined, a word about to be
+// redefined, along with anything that inlined those.
+void tier_redefine (const char* name)
+{
+    bool* hit;
+    bool changed = true;
+    int idx, j, k;
+
+    if (tier_num_records == 0) {
+        return;
+    }
+
+    hit = calloc(tier_num_records, sizeof(bool));
+
+    while (changed) {
+        changed = false;
+
+        for (idx = 0; idx < tier_num_records; idx++) {
+            tier_record* rec = &tier_records[idx];
+            bool stale = !strncmp(name, header_of(rec->body)->name, 7);
+
+            if (!rec->active) {
+                continue;
+            }
+
+            for (j = 0; j < rec->num_inlined && !stale; j++) {
+                uint8_t* callee = rec->inlined[j];
+
+                stale = !strncmp(name, header_of(callee)->name, 7);
+
+                for (k = 0; k < tier_num_records && !stale; k++) {
+                    stale = hit[k] && tier_records[k].body == callee;
+                }
+            }
+
+            if (stale) {
+                tier_deopt(rec);
+                hit[idx] = true;
+                changed = true;
+            }
+        }
+    }
+
+    free(hit);
+}
+
+
+// Profile guided branch layout.  --profile-out counts taken and not taken
+// jmp0s per site and writes the counts for each word at exit.
+// --use-profile reads them back, and atom_semicolon lays out each new word
+// so the usual path through an if falls through into the code after it.
+// The cold side moves past the word's exit and jumps back: a mostly taken
+// jmp0 becomes a jmpnz to the moved true side, and a mostly not taken
+// if/else moves its else side and drops the jmp over it.
+
+#define PGO_TABLE_SIZE      16384   // Power of 2
+#define PGO_MIN_SAMPLES     16
+
+typedef struct {
+    uint8_t* site;
+    uint32_t taken;
+    uint32_t not_taken;
+} branch_counts;
+
+typedef struct {
+    char name[8];
+    int nth;            // Which definition of the name, oldest first
+    uint32_t offset;    // Cell offset of the jmp0 in the body
+    uint32_t taken;
+    uint32_t not_taken;
+} branch_profile;
+
+branch_counts pgo_table[PGO_TABLE_SIZE];
+int pgo_table_used;
+branch_profile* pgo_profile;
+
+void pgo_count (uint8_t* site, bool taken)
+{
+    uint32_t idx = ((uint32_t)site >> 2) & (PGO_TABLE_SIZE - 1);
+
+    while (pgo_table[idx].site != site) {
+        if (pgo_table[idx].site == NULL) {
+            // Keep some room so probing always terminates.
+            if (pgo_table_used >= PGO_TABLE_SIZE - 1) {
+                return;
+            }
+
+            pgo_table[idx].site = site;
+            pgo_table_used++;
+            break;
+        }
+
+        idx = (idx + 1) & (PGO_TABLE_SIZE - 1);
+    }
+
+    if (taken) {
+        pgo_table[idx].taken++;
+    } else {
+        pgo_table[idx].not_taken++;
+    }
+}
+
+static branch_counts* pgo_find (uint8_t* site)
+{
+    uint32_t idx = ((uint32_t)site >> 2) & (PGO_TABLE_SIZE - 1);
+
+    while (pgo_table[idx].site != NULL) {
+        if (pgo_table[idx].site == site) {
+            return &pgo_table[idx];
+        }
+
+        idx = (idx + 1) & (PGO_TABLE_SIZE - 1);
+    }
+
+    return NULL;
+}
+
+// How many older visible definitions share this entry's name.
+static int definition_index (word_header* cur)
+{
+    word_header* older;
+    int nth = 0;
+
+    for (older = prev_entry(cur); older != NULL; older = prev_entry(older)) {
+        if ((older->flags & 0x03) == 0x01 && !strncmp(older->name, cur->name, 7)) {
+            nth++;
+        }
+    }
+
+    return nth;
+}
+
+bool pgo_write (const char* path)
+{
+    FILE* out = fopen(path, "w");
+    body_op* ops;
+    word_header** words;
+    int count;
+    int idx, i;
+
+    if (out == NULL) {
+        out_printf("can't open %s\n", path);
+        return false;
+    }
+
+    ops = malloc(MAX_BODY_OPS * sizeof(body_op));
+    count = collect_user_entries(&words);
+
+    for (idx = 0; idx < count; idx++) {
+        uint8_t* body = words[idx]->body;
+        int n = decode_body(body, ops, MAX_BODY_OPS);
+
+        for (i = 0; i < n; i++) {
+            branch_counts* bc;
+
+            if (ops[i].fn != atom_jmp0) {
+                continue;
+            }
+
+            bc = pgo_find(body + ops[i].offset * 4);
+            if (bc != NULL) {
+                fprintf(out, "%s %d %u %u %u\n", words[idx]->name,
+                        definition_index(words[idx]), ops[i].offset,
+                        bc->taken, bc->not_taken);
+            }
+        }
+    }
+
+    free(words);
+    free(ops);
+    fclose(out);
+
+    return true;
+}
+
+bool pgo_read (const char* path)
+{
+    FILE* in = fopen(path, "r");
+    branch_profile bp;
+    int cap = 0;
+
+    if (in == NULL) {
+        out_printf("can't open %s\n", path);
+        return false;
+    }
+
+    while (fscanf(in, "%7s %d %u %u %u", bp.name, &bp.nth, &bp.offset,
+                  &bp.taken, &bp.not_taken) == 5) {
+        if (pgo_profile_len == cap) {
+            cap = cap ? cap * 2 : 64;
+            pgo_profile = realloc(pgo_profile, cap * sizeof(branch_profile));
+        }
+
+        pgo_profile[pgo_profile_len++] = bp;
+    }
+
+    fclose(in);
+
+    return true;
+}
+
+// 1 if the branch is mostly taken, -1 if mostly not, 0 if unknown.
+static int pgo_bias (const char* name, int nth, uint32_t offset)
+{
+    int idx;
+
+    for (idx = 0; idx < pgo_profile_len; idx++) {
+        branch_profile* bp = &pgo_profile[idx];
+
+        if (bp->nth == nth && bp->offset == offset && !strncmp(bp->name, name, 7)) {
+            if (bp->taken + bp->not_taken < PGO_MIN_SAMPLES || bp->taken == bp->not_taken) {
+                return 0;
+            }
+
+            return (bp->taken > bp->not_taken) ? 1 : -1;
+        }
+    }
+
+    return 0;
+}
+
+static int seq_pos (int* seq, int len, int id)
+{
+    int p;
+
+    for (p = 0; p < len; p++) {
+        if (seq[p] == id) {
+            return p;
+        }
+    }
+
+    return -1;
+}
+
+// Can positions [lo, hi) be moved as a unit?  Branches inside may only land
+// in [lo, hi], and no other branch but the site's may land in [lo, hi).
+// The op 'leave', if any, is a jmp that moves with the region and may land
+// anywhere.
+static bool pgo_region_closed (body_op* ops, int* seq, int len, int lo, int hi, int site, int leave)
+{
+    int p;
+
+    for (p = 0; p < len; p++) {
+        body_op* op = &ops[seq[p]];
+        int t;
+
+        if (op->target < 0 || seq[p] == site || seq[p] == leave) {
+            continue;
+        }
+
+        t = seq_pos(seq, len, op->target);
+
+        if (p >= lo && p < hi) {
+            if (t < lo || t > hi) {
+                return false;
+            }
+        } else if (t >= lo && t < hi) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Lay out the jmp0 op 'site' so its hot side falls through to the code
+// after it, and the cold side sits past the end of the word with a jmp
+// back.  seq is the layout order of op ids, and a new jmp op may be added
+// at ops[*count].
+static bool pgo_relayout (body_op* ops, int* count, int* seq, int* len, int site, bool taken_hot)
+{
+    int p = seq_pos(seq, *len, site);
+    int pt = seq_pos(seq, *len, ops[site].target);
+    int first, e, x;
+    int px = -1;
+    int* moved;
+    int m = 0;
+    int k;
+
+    if (pt <= p + 1) {
+        return false;   // Backward branch or nothing to skip
+    }
+
+    first = seq[p + 1];
+    e = seq[pt - 1];
+
+    if (ops[e].fn == atom_jmp && ops[e].target >= 0) {
+        px = seq_pos(seq, *len, ops[e].target);
+    }
+
+    moved = malloc((*len + 1) * sizeof(int));
+
+    if (px > pt && taken_hot) {
+        // if/else:  jmp0 F  t.. jmp X  F.. X..  ->  jmpnz t  F.. X..  t.. jmp X
+        if (!pgo_region_closed(ops, seq, *len, p + 1, pt, site, e)) {
+            free(moved);
+            return false;
+        }
+
+        for (k = pt; k < *len; k++) {
+            moved[m++] = seq[k];
+        }
+        for (k = p + 1; k < pt; k++) {
+            moved[m++] = seq[k];
+        }
+
+        ops[site].fn = atom_jmpnz;
+        ops[site].target = first;
+    } else if (px > pt) {
+        // if/else:  jmp0 F  t.. jmp X  F.. X..  ->  jmp0 F  t.. X..  F.. jmp X
+        if (!pgo_region_closed(ops, seq, *len, pt, px, site, -1)) {
+            free(moved);
+            return false;
+        }
+
+        x = ops[e].target;
+
+        for (k = p + 1; k < pt - 1; k++) {
+            moved[m++] = seq[k];
+        }
+        for (k = px; k < *len; k++) {
+            moved[m++] = seq[k];
+        }
+        for (k = pt; k < px; k++) {
+            moved[m++] = seq[k];
+        }
+
+        // The true side falls into X now, so its jmp goes.
+        for (k = 0; k < *len; k++) {
+            if (ops[seq[k]].target == e) {
+                ops[seq[k]].target = x;
+            }
+        }
+
+        // Jump back from the end of the moved block.  The new jmp takes
+        // the place of the old one, so the length is unchanged.
+        ops[*count].fn = atom_jmp;
+        ops[*count].callee = NULL;
+        ops[*count].arg = 0;
+        ops[*count].target = x;
+        ops[*count].offset = 0;
+        moved[m++] = (*count)++;
+    } else if (taken_hot) {
+        // if/then:  jmp0 T  t..  T..  ->  jmpnz t  T..  t.. jmp T
+        if (!pgo_region_closed(ops, seq, *len, p + 1, pt, site, -1)) {
+            free(moved);
+            return false;
+        }
+
+        for (k = pt; k < *len; k++) {
+            moved[m++] = seq[k];
+        }
+        for (k = p + 1; k < pt; k++) {
+            moved[m++] = seq[k];
+        }
+
+        // Jump back from the end of the moved block.
+        ops[*count].fn = atom_jmp;
+        ops[*count].callee = NULL;
+        ops[*count].arg = 0;
+        ops[*count].target = ops[site].target;
+        ops[*count].offset = 0;
+        moved[m++] = (*count)++;
+        (*len)++;
+
+        ops[site].fn = atom_jmpnz;
+        ops[site].target = first;
+    } else {
+        // if/then with the body hot already falls through.
+        free(moved);
+        return false;
+    }
+
+    memcpy(&seq[p + 1], moved, m * sizeof(int));
+    free(moved);
+
+    return true;
+}
+
+// Re-lay the body of a just finished definition from the loaded profile.
+// The body is last in the dictionary, so it may grow in place.
+void pgo_layout (word_header* cur)
+{
+    uint8_t* body = cur->body;
+    int nth = definition_index(cur);
+    body_op* ops = malloc(2 * MAX_BODY_OPS * sizeof(body_op));
+    int* seq = malloc(2 * MAX_BODY_OPS * sizeof(int));
+    int n = decode_body(body, ops, MAX_BODY_OPS);
+    bool changed = false;
+    int count = n;
+    int len = n;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        seq[i] = i;
+    }
+
+    for (i = 0; i < n; i++) {
+        int bias;
+
+        if (ops[i].fn != atom_jmp0) {
+            continue;
+        }
+
+        bias = pgo_bias(cur->name, nth, ops[i].offset);
+        if (bias != 0) {
+            changed |= pgo_relayout(ops, &count, seq, &len, i, bias > 0);
+        }
+    }
+
+    if (changed) {
+        body_op* out = malloc(len * sizeof(body_op));
+        int* pos = malloc(count * sizeof(int));
+
+        for (i = 0; i < len; i++) {
+            pos[seq[i]] = i;
+        }
+
+        for (i = 0; i < len; i++) {
+            out[i] = ops[seq[i]];
+            if (out[i].target >= 0) {
+                out[i].target = pos[out[i].target];
+            }
+        }
+
+        // Each moved if/then adds a jmp; keep the old layout if it won't fit.
+        if (arena_room((int64_t)(body - here) + ops_size(out, len))) {
+            encode_ops(out, len, body);
+            here = body + ops_size(out, len);
+        }
+
+        free(pos);
+        free(out);
+    }
+
+    free(seq);
+    free(ops);
+}
+
+
+// Stops the inner loop and leaves the REPL, so main() can still write
+// its profile and emit-c output on the way out.
+void* atom_bye (void)
+{
+    print_fn(atom_bye);
+    out_printf("bye!\n");
+
+    bye_requested = true;
+    return NULL;
+}
+
+void create_native_entries (void)
+{
+    native_fword* nw;
+
+    for (nw = native_words; nw->fn != NULL; nw++) {
+        pino_register(nw->name, nw->fn, nw->flags);
+    }
+}
+
+void create_user_entries (void)
+{
+    uint32_t val;
+    uint8_t* push4_addr;
+
+#if 0
+    out_printf ("code arena: %p, here: %p used: %d\n",
+                code_arena, here, here - code_arena);
+
+    out_printf ("dictionary entry: %p (%d headers)\n", entry, entry - headers + 1);
+#endif
+
+    // Add push4 to dictionary
+    val = 0;
+    memcpy(here, &val, 4);      here += 4;
+    add_header("push4", here, 0x01);
+    push4_addr = here;          // Save this for later.
+    val = (uint32_t) atom_literal;
+    memcpy(here, &val, 4);      here += 4;
+    val = 4;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_exit;
+    memcpy(here, &val, 4);      here += 4;
+
+    // Add push8 to dictionary
+    val = 0;
+    memcpy(here, &val, 4);      here += 4;
+    add_header("push8", here, 0x01);
+    val = (uint32_t) push4_addr | 0x01;
+    memcpy(here, &val, 4);      here += 4;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_plus;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_exit;
+    memcpy(here, &val, 4);      here += 4;
+
+#if 0
+    // Add five? to dictionary
+    val = 0;
+    memcpy(here, &val, 4);      here += 4;
+    add_header("five?", here, 0x01);
+    val = (uint32_t) atom_literal;
+    memcpy(here, &val, 4);      here += 4;
+    val = -5;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_plus;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_jmp0;
+    memcpy(here, &val, 4);      here += 4;
+    val = 16;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_literal;
+    memcpy(here, &val, 4);      here += 4;
+    val = 0;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_jmp;
+    memcpy(here, &val, 4);      here += 4;
+    val = 8;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_literal;
+    memcpy(here, &val, 4);      here += 4;
+    val = 1;
+    memcpy(here, &val, 4);      here += 4;
+    val = (uint32_t) atom_exit;
+    memcpy(here, &val, 4);      here += 4;
+#endif
+
+#if 0
+    out_printf ("code arena: %p, here: %p used: %d\n",
+                code_arena, here, here - code_arena);
+
+    out_printf ("dictionary entry: %p (%d headers)\n", entry, entry - headers + 1);
+    out_flush();
+#endif
+}
+
+int read_input_line (void)
+{
+    char* ret;
+
+    input_offset = 0;
+    input_buffer[0]='\0';
+
+    // Anything still buffered has to be seen before we block.
+    out_flush();
+
+    ret = fgets(input_buffer, sizeof(input_buffer), stdin);
+    if (ret == NULL) {
+        return 0;
+    }
+
+    // Strip newlines.
+    input_buffer[strcspn(input_buffer, "\n\r")] = ' ';
+
+    return strlen(ret);
+}
+
+static inline bool is_blank (char c)
+{
+    return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+// The next blank delimited token, terminated in place in input_buffer.
+char* lex(void)
+{
+    char* tok;
+
+    while (is_blank(input_buffer[input_offset])) {
+        input_offset++;
+    }
+
+    if (input_buffer[input_offset] == '\0') {
+        return NULL;
+    }
+
+    tok = &input_buffer[input_offset];
+
+    while (input_buffer[input_offset] != '\0' && !is_blank(input_buffer[input_offset])) {
+        input_offset++;
+    }
+
+    // Step over the delimiter too, so parse() starts just after it.
+    if (input_buffer[input_offset] != '\0') {
+        input_buffer[input_offset++] = '\0';
+    }
+
+    return tok;
+}
+
+// The input up to delim, or the end of the line, as a slice.  The
+// delimiter is consumed.
+char* parse (char delim, uint32_t* len)
+{
+    char* start = &input_buffer[input_offset];
+    char* end = strchr(start, delim);
+
+    if (end == NULL) {
+        end = start + strlen(start);
+        input_offset += end - start;
+    } else {
+        input_offset += end - start + 1;
+    }
+
+    *len = end - start;
+    return start;
+}
+
+
+void run_inner_loop (void)
+{
+    // Get the first word
+    fword next_word = next();
+
+    // Run until done.
+    while (next_word != NULL) {
+        int err;
+
+        next_word = next_word();
+
+        // Check every time, but could be done only in certain points.
+        err = check_stack_range();
+        if (err != 0) {
+            next_word = pino_throw(err);
+        }
+    }
+}
+
+
+__thread fword exec_springboard[] = {
+    atom_exit,  // Replaced by word to execute.
+    atom_exit
+};
+
+void execute (uint8_t* body, uint8_t flags)
+{
+    // Copy to springboard and jump
+    if (flags & 0x01) {
+        uint32_t val = (uint32_t)body | 0x01;
+        exec_springboard[0] = (fword)val;
+    } else {
+        exec_springboard[0] = *(fword*)body;
+    }
+
+    push_r(NULL);
+    i_ptr = exec_springboard;
+
+
+    run_inner_loop();
+
+}
+
+
+// Fork-join over cell arrays.  The array is cut into one chunk per
+// worker and each worker runs the xt over its chunk through execute(),
+// on its own stacks.  The caller waits for all of them.  The xt must not
+// compile or allot; the dictionary is shared.  Nor may it call par-map or
+// par-reduce, since the workers are all busy with the outer batch; that
+// throws THROW_UNSUPPORTED instead of deadlocking.
+
+#define PAR_MAX_WORKERS     64
+#define PAR_MIN_CHUNK       64      // Fewer cells than this per worker isn't worth a thread
+
+typedef struct {
+    word_header* xt;
+    int32_t* addr;
+    uint32_t n;
+    bool reduce;        // Fold the chunk into result instead of mapping it
+    int32_t result;
+    int error;          // Throw code that stopped the chunk, 0 if none
+} par_job;
+
+pthread_t par_threads[PAR_MAX_WORKERS];
+par_job par_jobs[PAR_MAX_WORKERS];
+int par_workers;
+int par_active;         // Jobs in the current batch
+int par_pending;        // Workers still busy with it
+unsigned int par_batch;
+__thread bool par_in_worker;
+pthread_mutex_t par_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t par_start = PTHREAD_COND_INITIALIZER;
+pthread_cond_t par_done = PTHREAD_COND_INITIALIZER;
+
+static void par_run (par_job* job)
+{
+    uint32_t i;
+
+    job->error = 0;
+
+    for (i = 0; i < job->n; i++) {
+        if (job->reduce) {
+            if (i == 0) {
+                job->result = job->addr[0];
+                continue;
+            }
+
+            push_d(job->result);
+        }
+
+        push_d(job->addr[i]);
+        execute(job->xt->body, job->xt->flags);
+
+        if (pending_throw != 0 || tods != BASE_OF_STACK + 1) {
+            if (pending_throw != 0) {
+                job->error = pending_throw;
+            } else {
+                job->error = (tods <= BASE_OF_STACK) ? THROW_STACK_UNDERFLOW : THROW_STACK_OVERFLOW;
+            }
+
+            tods = BASE_OF_STACK;
+            tors = BASE_OF_STACK;
+            catch_frame = 0;
+            pending_throw = 0;
+            coro_abandon(NULL);
+            return;
+        }
+
+        if (job->reduce) {
+            job->result = (int32_t)pop_d();
+        } else {
+            job->addr[i] = (int32_t)pop_d();
+        }
+    }
+}
+
+static void* par_worker (void* arg)
+{
+    int id = (int)(intptr_t)arg;
+    unsigned int seen = 0;
+
+    tods = BASE_OF_STACK;
+    tors = BASE_OF_STACK;
+    par_in_worker = true;
+
+    while (1) {
+        pthread_mutex_lock(&par_lock);
+        while (par_batch == seen) {
+            pthread_cond_wait(&par_start, &par_lock);
+        }
+        seen = par_batch;
+        pthread_mutex_unlock(&par_lock);
+
+        if (id < par_active) {
+            par_run(&par_jobs[id]);
+        }
+
+        pthread_mutex_lock(&par_lock);
+        if (--par_pending == 0) {
+            pthread_cond_signal(&par_done);
+        }
+        pthread_mutex_unlock(&par_lock);
+    }
+
+    return NULL;
+}
+
+// Start the pool on first use, one worker per online CPU.
+static bool par_init (void)
+{
+    long cpus;
+
+    if (par_workers > 0) {
+        return true;
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    } else if (cpus > PAR_MAX_WORKERS) {
+        cpus = PAR_MAX_WORKERS;
+    }
+
+    while (par_workers < cpus) {
+        if (pthread_create(&par_threads[par_workers], NULL, par_worker,
+                           (void*)(intptr_t)par_workers) != 0) {
+            break;
+        }
+
+        pthread_detach(par_threads[par_workers]);
+        par_workers++;
+    }
+
+    return (par_workers > 0);
+}
+
+// Run the first count jobs and wait for them.  Returns the first error.
+static int par_dispatch (int count)
+{
+    int idx;
+
+    pthread_mutex_lock(&par_lock);
+    par_active = count;
+    par_pending = par_workers;
+    par_batch++;
+    pthread_cond_broadcast(&par_start);
+
+    while (par_pending > 0) {
+        pthread_cond_wait(&par_done, &par_lock);
+    }
+    pthread_mutex_unlock(&par_lock);
+
+    for (idx = 0; idx < count; idx++) {
+        if (par_jobs[idx].error != 0) {
+            return par_jobs[idx].error;
+        }
+    }
+
+    return 0;
+}
+
+// Cut addr/n into jobs for the workers.  Returns the number of jobs.
+static int par_split (int32_t* addr, uint32_t n, word_header* xt, bool reduce)
+{
+    uint32_t count = (n + PAR_MIN_CHUNK - 1) / PAR_MIN_CHUNK;
+    uint32_t start = 0;
+    uint32_t idx;
+
+    if (count > (uint32_t)par_workers) {
+        count = par_workers;
+    }
+
+    for (idx = 0; idx < count; idx++) {
+        uint32_t end = (uint32_t)((uint64_t)n * (idx + 1) / count);
+
+        par_jobs[idx].xt = xt;
+        par_jobs[idx].addr = addr + start;
+        par_jobs[idx].n = end - start;
+        par_jobs[idx].reduce = reduce;
+        start = end;
+    }
+
+    return count;
+}
+
+void* atom_par_map (void)   // ( addr n xt -- ), xt is ( x -- y )
+{
+    word_header* xt = pop_xt();
+    uint32_t n = (uint32_t)pop_d();
+    int32_t* addr = (int32_t*)pop_d();
+    int err;
+
+    print_fn(atom_par_map);
+
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
+
+    if (par_in_worker || !par_init()) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
+
+    err = par_dispatch(par_split(addr, n, xt, false));
+    if (err != 0) {
+        return pino_throw(err);
+    }
+
+    return next();
+}
+
+// ( addr n x0 xt -- x ), xt is ( a b -- c ) and must be associative.
+// Chunks are folded in parallel, then x0 and the partial results in
+// order on one worker.
+void* atom_par_reduce (void)
+{
+    word_header* xt = pop_xt();
+    int32_t partial[PAR_MAX_WORKERS + 1];
+    uint32_t n;
+    int32_t* addr;
+    int count;
+    int idx;
+    int err;
+
+    partial[0] = (int32_t)pop_d();
+    n = (uint32_t)pop_d();
+    addr = (int32_t*)pop_d();
+
+    print_fn(atom_par_reduce);
+
+    if (xt == NULL) {
+        return pino_throw(THROW_UNDEFINED);
+    }
+
+    if (par_in_worker || !par_init()) {
+        return pino_throw(THROW_UNSUPPORTED);
+    }
+
+    count = par_split(addr, n, xt, true);
+    err = par_dispatch(count);
+
+    if (err == 0 && count > 0) {
+        for (idx = 0; idx < count; idx++) {
+            partial[idx + 1] = par_jobs[idx].result;
+        }
+
+        // Job 0 already has the xt.
+        par_jobs[0].addr = partial;
+        par_jobs[0].n = count + 1;
+        err = par_dispatch(1);
+    }
+
+    if (err != 0) {
+        return pino_throw(err);
+    }
+
+    push_d((count > 0) ? par_jobs[0].result : partial[0]);
+    return next();
+}
+
+
+
+bool parse_number(char* tok, int32_t* val)
+{
+    int retval;
+    int32_t num;
+
+
+    // Attempt to interpret it as a number.
+    retval = sscanf(tok, "%d", &num);
+    // printf ("sscanf retval: %d\n", retval);
+    if (retval > 0) {
+        *val = num;
+    }
+
+
+    return (retval > 0);
+}
+
+static inline bool is_immediate_word (uint8_t flags)
+{
+    return ((flags & 0x04) != 0);
+}
+
+static inline bool is_user_word (uint8_t flags)
+{
+    return ((flags & 0x01) != 0);
+}
+
+
+bool compile_word (uint8_t* body, bool is_user_word)
+{
+    if (!arena_room(4)) {
+        return false;
+    }
+
+    if (verbosity >= 2) {
+        out_printf("compiling %p into dictionary\n", body);
+    }
+
+    if (is_user_word) {
+        uint32_t val = (uint32_t)body | 0x01;
+        memcpy(here, &val, 4);
+    } else {
+        memcpy(here, body, 4);
+    }
+
+    here += 4;
+
+    return true;
+}
+
+bool compile_literal (int32_t val)
+{
+    if (!arena_room(8)) {
+        return false;
+    }
+
+    if (verbosity >= 2) {
+        out_printf("compiling literal %d into dictionary\n", val);
+    }
+
+    *(fword*)here = atom_literal;
+    here += 4;
+    memcpy(here, &val, 4);
+    here += 4;
+
+    return true;
+}
+
+
+static void report_throw (int code)
+{
+    const char* msg = throw_message(code);
+
+    if (msg != NULL) {
+        out_printf("%s\n", msg);
+    } else {
+        out_printf("Uncaught throw %d\n", code);
+    }
+}
+
+// Put the interpreter back in a usable state after an uncaught throw:
+// empty stacks, and any half compiled definition dropped.
+void abort_to_repl (void)
+{
+    tods = BASE_OF_STACK;
+    tors = BASE_OF_STACK;
+    catch_frame = 0;
+    pending_throw = 0;
+    perf_depth = 0;
+
+    coro_abandon(NULL);
+    co_base = 0;
+
+    if (entry != NULL && (entry->flags & 0x02)) {
+        entry = prev_entry(entry);
+        here = def_start;
+    }
+
+    compile_mode = false;
+    postpone_flag = false;
+}
+
+void repl (void)
+{
+
+    while (!bye_requested) {
+        bool error = false;
+
+        out_printf ("> ");
+        int num_read = read_input_line();
+        if (num_read == 0) {
+            out_printf(" bye!\n");
+            break;
+        }
+
+
+        while (1) {
+            uint8_t flags;
+            int32_t val;
+            char* tok = lex();
+
+            if (!tok) {
+                break;
+            }
+
+            uint8_t* body_ptr = find_word(tok, &flags);
+
+            if (postpone_flag) {
+                flags &= ~0x04;          // Clear the immediate flag
+                postpone_flag = false;  // But only once.
+            }
+
+            if (body_ptr != NULL) {
+                if (!compile_mode || is_immediate_word(flags)) {
+                    execute (body_ptr, flags);
+
+                    if (pending_throw != 0) {
+                        report_throw(pending_throw);
+                        abort_to_repl();
+                        error = true;
+                        break;
+                    }
+
+                    if (bye_requested) {
+                        error = true;
+                        break;
+                    }
+                } else if (!compile_word (body_ptr, is_user_word(flags))) {
+                    report_throw(THROW_DICT_OVERFLOW);
+                    abort_to_repl();
+                    error = true;
+                    break;
+                }
+            } else if (parse_number(tok, &val)) {
+                if (compile_mode) {
+                    if (!compile_literal(val)) {
+                        report_throw(THROW_DICT_OVERFLOW);
+                        abort_to_repl();
+                        error = true;
+                        break;
+                    }
+                } else {
+                    push_d(val);
+                }
+            } else {
+                out_printf ("%s?\n", tok);
+                abort_to_repl();
+                error = true;
+                break;
+            }
+        }
+
+        if (!error) {
+            out_printf ("  ok\n");
+        }
+    }
+}
+
+
+// Collect the visible user entries, oldest first.  Returns the count and
+// a malloc'd array in *list, which the caller frees.
+int collect_user_entries (word_header*** list)
+{
+    word_header* cur;
+    int count = 0;
+    int idx;
+
+    for (cur = entry; cur != NULL; cur = prev_entry(cur)) {
+        if ((cur->flags & 0x03) == 0x01) {
+            count++;
+        }
+    }
+
+    *list = malloc((count + 1) * sizeof(word_header*));
+    idx = count;
+
+    for (cur = entry; cur != NULL; cur = prev_entry(cur)) {
+        if ((cur->flags & 0x03) == 0x01) {
+            (*list)[--idx] = cur;
+        }
+    }
+
+    return count;
+}
+
+
+// Hardware counter attribution for --perf-counters.  The counters are
+// read as one group at each user word entry and exit, and the difference
+// since the last read is charged to the word running in between, so the
+// totals are self counts.
+
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1I_MISSES,
+    PERF_NUM_COUNTERS
+};
+
+const char* perf_counter_names[PERF_NUM_COUNTERS] = {
+    "cycles", "instrs", "br-miss", "l1i-miss"
+};
+
+typedef struct {
+    uint8_t* body;
+    uint64_t calls;
+    uint64_t counts[PERF_NUM_COUNTERS];
+} word_counters;
+
+#define PERF_TABLE_SIZE     8192    // Power of 2
+
+word_counters perf_table[PERF_TABLE_SIZE];
+word_counters* perf_stack[MAX_STACK_SIZE];
+__thread unsigned int perf_depth;
+uint64_t perf_last[PERF_NUM_COUNTERS];
+
+int perf_leader = -1;
+int perf_slot[PERF_NUM_COUNTERS];   // Position in the group read, -1 if missing
+int perf_opened;
+
+static int perf_open (uint32_t type, uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+bool perf_counters_init (void)
+{
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_NUM_COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+    int idx;
+
+    perf_opened = 0;
+
+    for (idx = 0; idx < PERF_NUM_COUNTERS; idx++) {
+        int fd = perf_open(events[idx].type, events[idx].config, perf_leader);
+
+        if (fd < 0) {
+            // The cycle counter leads the group, so it has to be there.
+            if (idx == PERF_CYCLES) {
+                out_printf("perf_event_open failed, counters unavailable\n");
+                return false;
+            }
+
+            out_printf("%s counter unavailable\n", perf_counter_names[idx]);
+            perf_slot[idx] = -1;
+            continue;
+        }
+
+        if (perf_leader == -1) {
+            perf_leader = fd;
+        }
+
+        perf_slot[idx] = perf_opened++;
+    }
+
+    ioctl(perf_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    perf_depth = 0;
+    perf_counters_enabled = true;
+
+    return true;
+}
+
+static word_counters* perf_lookup (uint8_t* body)
+{
+    uint32_t idx = ((uint32_t)body >> 3) & (PERF_TABLE_SIZE - 1);
+
+    while (perf_table[idx].body != body && perf_table[idx].body != NULL) {
+        idx = (idx + 1) & (PERF_TABLE_SIZE - 1);
+    }
+
+    perf_table[idx].body = body;
+    return &perf_table[idx];
+}
+
+// Charge the counts since the last read to the running word.
+static void perf_charge (void)
 {
-    uint8_t* cur;
-    bool found = false;
-    uint32_t link;
-    uint8_t* name;
-    uint8_t* body;
+    uint64_t buf[1 + PERF_NUM_COUNTERS];
+    int idx;
 
-    cur = entry;
+    if (read(perf_leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) {
+        return;
+    }
 
-    while (cur != NULL) {
-        link = *(uint32_t*)cur;
-        name = cur + 4;
-        body = cur + 12;
+    for (idx = 0; idx < PERF_NUM_COUNTERS; idx++) {
+        uint64_t now;
 
-#if 0
-        printf ("%x link = %08x, name = %8s, body = %p\n",
-                (link & 0x07), link, name, body);
-        fflush(stdout);
-#endif
+        if (perf_slot[idx] < 0) {
+            continue;
+        }
 
-        // Is entry active?
-        if ((link & 0x02) == 0) {
+        now = buf[1 + perf_slot[idx]];
 
-            if (!strncmp (word_to_find, name, 7)) {
-                found = true;
-                break;
-            }
+        if (perf_depth > 0) {
+            perf_stack[perf_depth - 1]->counts[idx] += now - perf_last[idx];
         }
 
-        cur = (uint8_t*)(link & ~0x7);
+        perf_last[idx] = now;
     }
+}
+
+void perf_word_enter (uint8_t* body)
+{
+    word_counters* wc = perf_lookup(body);
 
-    if (found) {
-        *flags = (link & 0x07);
-        return body;
+    perf_charge();
+
+    if (perf_depth < MAX_STACK_SIZE) {
+        perf_stack[perf_depth++] = wc;
     }
 
-    return NULL;
+    wc->calls++;
 }
 
-
-void* atom_bye (void)
+void perf_word_exit (void)
 {
-    print_fn(atom_bye);
-    printf("bye!\n");
-    exit(0);
+    // The execute() springboard exits without a matching user word entry.
+    if (perf_depth == 0) {
+        return;
+    }
+
+    perf_charge();
+    perf_depth--;
 }
 
-void create_user_entries (void)
+// Coroutine switches move the levels above base out to buf and back, so
+// a suspended coroutine's words stop being charged while it waits.
+unsigned int perf_stash (unsigned int base, void** buf, unsigned int max)
 {
-    uint32_t val;
-    uint8_t* push4_addr;
+    unsigned int n = 0;
 
-#if 0
-    printf ("dictionary: %p, here: %p offset: %d diff: %d\n",
-                dictionary, here,
-                LAST_ENTRY_IDX * sizeof(native_fword),
-                here - dictionary);
+    if (perf_depth > base) {
+        perf_charge();
 
-    printf ("dictionary entry: %p\n", entry);
-#endif
+        n = perf_depth - base;
+        if (n > max) {
+            n = max;
+        }
 
-    // Add push4 to dictionary
-    val = (uint32_t)entry | 0x01;
-    entry = here;
-    memcpy(here, &val, 4);      here += 4;
-    strcpy(here, "push4");      here += 8;
-    push4_addr = here;          // Save this for later.
-    val = (uint32_t) atom_literal;
-    memcpy(here, &val, 4);      here += 4;
-    val = 4;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_exit;
-    memcpy(here, &val, 4);      here += 4;
+        memcpy(buf, &perf_stack[base], n * sizeof(void*));
+    }
 
-    // Add push8 to dictionary
-    val = (uint32_t)entry | 0x01;
-    entry = here;
-    memcpy(here, &val, 4);      here += 4;
-    strcpy(here, "push8");      here += 8;
-    val = (uint32_t) push4_addr | 0x01;
-    memcpy(here, &val, 4);      here += 4;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_plus;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_exit;
-    memcpy(here, &val, 4);      here += 4;
+    perf_depth = base;
+    return n;
+}
 
-#if 0
-    // Add five? to dictionary
-    here += 4;  // Alignment
-    val = (uint32_t)entry | 0x01;
-    entry = here;
-    memcpy(here, &val, 4);      here += 4;
-    strcpy(here, "five?");      here += 8;
-    val = (uint32_t) atom_literal;
-    memcpy(here, &val, 4);      here += 4;
-    val = -5;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_plus;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_jmp0;
-    memcpy(here, &val, 4);      here += 4;
-    val = 16;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_literal;
-    memcpy(here, &val, 4);      here += 4;
-    val = 0;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_jmp;
-    memcpy(here, &val, 4);      here += 4;
-    val = 8;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_literal;
-    memcpy(here, &val, 4);      here += 4;
-    val = 1;
-    memcpy(here, &val, 4);      here += 4;
-    val = (uint32_t) atom_exit;
-    memcpy(here, &val, 4);      here += 4;
-#endif
+void perf_unstash (void** buf, unsigned int n)
+{
+    if (n == 0 || perf_depth + n > MAX_STACK_SIZE) {
+        return;
+    }
 
-#if 0
-    printf ("dictionary: %p, here: %p offset: %d diff: %d\n",
-                dictionary, here,
-                LAST_ENTRY_IDX * sizeof(native_fword),
-                here - dictionary);
+    perf_charge();
 
-    printf ("dictionary entry: %p\n", entry);
-    fflush(stdout);
-#endif
+    memcpy(&perf_stack[perf_depth], buf, n * sizeof(void*));
+    perf_depth += n;
 }
 
-int read_input_line (void)
+void* atom_counters (void)
 {
-    char* ret;
+    word_header* cur;
+    int idx;
 
-    input_offset = 0;
-    input_buffer[0]='\0';
+    print_fn(atom_counters);
 
-    ret = fgets(input_buffer, sizeof(input_buffer), stdin);
-    if (ret == NULL) {
-        return 0;
+    if (!perf_counters_enabled) {
+        out_printf("perf counters not enabled, run with --perf-counters\n");
+        return next();
     }
 
-    // Strip newlines.
-    input_buffer[strcspn(input_buffer, "\n\r")] = ' ';
+    out_printf("%-8s %10s", "word", "calls");
+    for (idx = 0; idx < PERF_NUM_COUNTERS; idx++) {
+        out_printf(" %12s", perf_counter_names[idx]);
+    }
+    out_printf("\n");
 
-    return strlen(ret);
-}
+    for (cur = entry; cur != NULL; cur = prev_entry(cur)) {
+        word_counters* wc;
 
-char* lex(void)
-{
-    bool string_start = (input_offset == 0);
-    char* tok;
+        if ((cur->flags & 0x01) == 0) {
+            continue;
+        }
 
-    if (string_start) {
-        tok = strtok(input_buffer, "\r\n\t ");
-    } else {
-        tok = strtok(NULL, "\r\n\t ");
-    }
+        wc = perf_lookup(cur->body);
+        if (wc->calls == 0) {
+            continue;
+        }
 
-    if (tok != NULL) {
-        input_offset += strlen(tok);
+        out_printf("%-8s %10llu", cur->name, (unsigned long long)wc->calls);
+        for (idx = 0; idx < PERF_NUM_COUNTERS; idx++) {
+            if (perf_slot[idx] < 0) {
+                out_printf(" %12s", "-");
+            } else {
+                out_printf(" %12llu", (unsigned long long)wc->counts[idx]);
+            }
+        }
+        out_printf("\n");
     }
 
-    return tok;
+    return next();
 }
 
 
-void run_inner_loop (void)
+// Symbol export for perf.  --perf-map appends "start size name" lines to
+// /tmp/perf-<pid>.map, and --jitdump writes the same words as code load
+// records to /tmp/jit-<pid>.dump, which perf inject --jit picks up.  Both
+// are written as words are defined, and again by anything that generates
+// new code for a word.
+//
+// The ranges cover threaded bodies, which are data: no instruction runs
+// there, so perf never samples an IP inside them and perf report won't
+// show Forth word names.  Samples land in next() and the atom_*
+// functions.  The entries only annotate those data ranges, e.g. for perf
+// annotate or mem sampling, until words get native code.  Use
+// --perf-counters for time charged per word.
+
+FILE* perf_map_file;
+FILE* jitdump_file;
+void* jitdump_marker;
+uint64_t jitdump_index;
+
+#define JITDUMP_MAGIC       0x4A695444
+#define JITDUMP_VERSION     1
+#define JIT_CODE_LOAD       0
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} jitdump_header;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} jitdump_code_load;
+
+static uint64_t jitdump_timestamp (void)
 {
-    // Get the first word
-    fword next_word = next();
+    struct timespec ts;
 
-    // Run until done.
-    while (next_word != NULL) {
+    // perf record -k mono uses the same clock.
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-        next_word = next_word();
-        check_stack_range();    // Check every time, but could be done only in certain points.
+bool perf_map_init (bool jitdump)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    perf_map_file = fopen(path, "a");
+    if (perf_map_file == NULL) {
+        out_printf("can't open %s\n", path);
+        return false;
     }
-}
 
+    if (jitdump) {
+        jitdump_header hdr;
 
-fword exec_springboard[] = {
-    atom_exit,  // Replaced by word to execute.
-    atom_exit
-};
+        snprintf(path, sizeof(path), "/tmp/jit-%d.dump", (int)getpid());
+        jitdump_file = fopen(path, "w+");
+        if (jitdump_file == NULL) {
+            out_printf("can't open %s\n", path);
+            return false;
+        }
 
-void execute (uint8_t* body, uint8_t flags)
-{
-    // Copy to springboard and jump
-    if (flags & 0x01) {
-        uint32_t val = (uint32_t)body | 0x01;
-        exec_springboard[0] = (fword)val;
-    } else {
-        exec_springboard[0] = *(fword*)body;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = JITDUMP_MAGIC;
+        hdr.version = JITDUMP_VERSION;
+        hdr.total_size = sizeof(hdr);
+#if defined(__x86_64__)
+        hdr.elf_mach = EM_X86_64;
+#else
+        hdr.elf_mach = EM_386;
+#endif
+        hdr.pid = getpid();
+        hdr.timestamp = jitdump_timestamp();
+
+        fwrite(&hdr, sizeof(hdr), 1, jitdump_file);
+        fflush(jitdump_file);
+
+        // perf finds the dump file through this executable mapping of it.
+        jitdump_marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                              MAP_PRIVATE, fileno(jitdump_file), 0);
+        if (jitdump_marker == MAP_FAILED) {
+            out_printf("can't map %s\n", path);
+            jitdump_marker = NULL;
+        }
     }
 
-    push_r(NULL);
-    i_ptr = exec_springboard;
+    perf_map_enabled = true;
 
+    return true;
+}
 
-    run_inner_loop();
+void perf_map_word (uint8_t* addr, uint32_t size, const char* name)
+{
+    fprintf(perf_map_file, "%lx %x %s\n", (unsigned long)(uintptr_t)addr, size, name);
+    fflush(perf_map_file);
+
+    if (jitdump_file != NULL) {
+        jitdump_code_load rec;
+
+        rec.id = JIT_CODE_LOAD;
+        rec.total_size = sizeof(rec) + strlen(name) + 1 + size;
+        rec.timestamp = jitdump_timestamp();
+        rec.pid = getpid();
+        rec.tid = syscall(SYS_gettid);
+        rec.vma = (uintptr_t)addr;
+        rec.code_addr = (uintptr_t)addr;
+        rec.code_size = size;
+        rec.code_index = jitdump_index++;
+
+        fwrite(&rec, sizeof(rec), 1, jitdump_file);
+        fwrite(name, strlen(name) + 1, 1, jitdump_file);
+        fwrite(addr, size, 1, jitdump_file);
+        fflush(jitdump_file);
+    }
+}
 
+void perf_map_entry (word_header* cur, uint32_t size)
+{
+    perf_map_word(cur->body, size, cur->name);
 }
 
+// Size in bytes of a complete user word body, 0 if it can't be decoded.
+uint32_t body_size (uint8_t* body)
+{
+    body_op* ops = malloc(MAX_BODY_OPS * sizeof(body_op));
+    int n = decode_body(body, ops, MAX_BODY_OPS);
+    uint32_t size = (n > 0) ? (ops[n - 1].offset + op_cells(&ops[n - 1])) * 4 : 0;
 
+    free(ops);
+    return size;
+}
 
-bool parse_number(char* tok, int32_t* val)
+// Export the user words that already exist, e.g. the built-in ones.
+void perf_map_existing (void)
 {
-    int retval;
-    int32_t num;
+    word_header** words;
+    int count = collect_user_entries(&words);
+    int idx;
 
+    for (idx = 0; idx < count; idx++) {
+        uint32_t size = body_size(words[idx]->body);
 
-    // Attempt to interpret it as a number.
-    retval = sscanf(tok, "%d", &num);
-    // printf ("sscanf retval: %d\n", retval);
-    if (retval > 0) {
-        *val = num;
+        if (size > 0) {
+            perf_map_entry(words[idx], size);
+        }
     }
 
-
-    return (retval > 0);
+    free(words);
 }
 
-static inline bool is_immediate_word (uint8_t flags)
+
+static void emit_c_bytes (FILE* out, const uint8_t* str, uint32_t len)
 {
-    return ((flags & 0x04) != 0);
+    uint32_t i;
+
+    fputc('"', out);
+
+    for (i = 0; i < len; i++) {
+        if (str[i] == '"' || str[i] == '\\') {
+            fprintf(out, "\\%c", str[i]);
+        } else if (str[i] < ' ' || str[i] > '~') {
+            fprintf(out, "\\%03o", str[i]);
+        } else {
+            fputc(str[i], out);
+        }
+    }
+
+    fputc('"', out);
 }
 
-static inline bool is_user_word (uint8_t flags)
+static void emit_c_string (FILE* out, const char* str)
 {
-    return ((flags & 0x01) != 0);
+    emit_c_bytes(out, (const uint8_t*)str, strlen(str));
 }
 
-
-void compile_word (uint8_t* body, bool is_user_word)
+static int emit_c_find (word_header** words, int count, uint8_t* body)
 {
-    printf("compiling %p into dictionary\n", body);
-    fflush(stdout);
+    int idx;
 
-    if (is_user_word) {
-        uint32_t val = (uint32_t)body | 0x01;
-        memcpy(here, &val, 4);
-    } else {
-        memcpy(here, body, 4);
+    for (idx = 0; idx < count; idx++) {
+        if (words[idx]->body == body) {
+            return idx;
+        }
     }
 
-    here += 4;
-
+    return -1;
 }
 
-void compile_literal (int32_t val)
+static bool emit_c_is_address (int32_t val)
 {
-    printf("compiling literal %d into dictionary\n", val);
-    fflush(stdout);
+    uint8_t* addr = (uint8_t*)(intptr_t)val;
 
-    *(fword*)here = atom_literal;
-    here += 4;
-    memcpy(here, &val, 4);
-    here += 4;
+    return (addr >= code_arena && addr < code_arena + CODE_ARENA_SIZE) ||
+           (addr >= (uint8_t*)headers && addr < (uint8_t*)(headers + MAX_WORDS));
 }
 
-
-void repl (void)
+// Can the word be translated?  Words are checked oldest first, so any
+// callee has already been decided by the time its callers are checked.
+static bool emit_c_check (word_header** words, bool* ok, int idx, body_op* ops)
 {
+    int n = decode_body(words[idx]->body, ops, MAX_BODY_OPS);
+    int i;
 
-    while (1) {
-        bool error = false;
+    if (n < 0) {
+        return false;
+    }
 
-        printf ("> ");
-        fflush(stdout);
-        int num_read = read_input_line();
-        if (num_read == 0) {
-            printf(" bye!\n");
-            break;
-        }
+    for (i = 0; i < n; i++) {
+        if (ops[i].fn == NULL) {
+            int callee = emit_c_find(words, idx, ops[i].callee);
 
+            if (callee < 0 || !ok[callee]) {
+                return false;
+            }
+        } else {
+            prim_info* info = find_prim_info(ops[i].fn);
 
-        while (1) {
-            uint8_t flags;
-            int32_t val;
-            char* tok = lex();
+            if (info == NULL || info->c_code == NULL) {
+                return false;
+            }
 
-            if (!tok) {
-                fflush(stdout);
-                break;
+            // Addresses of create data or xts mean nothing in the
+            // translated program, which has no dictionary.
+            if (info->operand == OPERAND_LIT && emit_c_is_address(ops[i].arg)) {
+                return false;
             }
+        }
+    }
 
-            uint8_t* body_ptr = find_word(tok, &flags);
+    return true;
+}
 
-            if (postpone_flag) {
-                flags &= ~0x04;          // Clear the immediate flag
-                postpone_flag = false;  // But only once.
-            }
+static void emit_c_word (FILE* out, word_header** words, int idx, body_op* ops)
+{
+    int n = decode_body(words[idx]->body, ops, MAX_BODY_OPS);
+    bool is_target[MAX_BODY_OPS] = {false};
+    int i;
 
-            if (body_ptr != NULL) {
-                if (!compile_mode || is_immediate_word(flags)) {
-                    execute (body_ptr, flags);
-                } else {
-                    compile_word (body_ptr, is_user_word(flags));
-                }
-            } else if (parse_number(tok, &val)) {
-                if (compile_mode) {
-                    compile_literal(val);
-                } else {
-                    push_d(val);
-                }
+    for (i = 0; i < n; i++) {
+        if (ops[i].target >= 0) {
+            is_target[ops[i].target] = true;
+        }
+    }
+
+    fprintf(out, "\n// %s\nvoid pino_w%d (void)\n{\n", words[idx]->name, idx);
+
+    for (i = 0; i < n; i++) {
+        if (is_target[i]) {
+            fprintf(out, "L%d:\n", i);
+        }
+
+        fprintf(out, "    ");
+
+        if (ops[i].fn == NULL) {
+            fprintf(out, "pino_w%d();", emit_c_find(words, idx, ops[i].callee));
+        } else {
+            prim_info* info = find_prim_info(ops[i].fn);
+
+            if (info->operand == OPERAND_BRANCH) {
+                fprintf(out, info->c_code, ops[i].target);
+            } else if (info->operand == OPERAND_STRING) {
+                fprintf(out, "{ static const char s[] = ");
+                emit_c_bytes(out, ops[i].data, ops[i].arg);
+                fprintf(out, "; ");
+                fprintf(out, info->c_code, ops[i].arg);
+                fprintf(out, " }");
             } else {
-                printf ("%s?\n", tok);
-                error = true;
-                break;
+                fprintf(out, info->c_code, ops[i].arg);
             }
         }
 
-        if (!error) {
-            printf ("  ok\n");
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "}\n");
+}
+
+// Translate every user word into a C function.  The output builds against
+// the primitive runtime, i.e. pino.c compiled without its own main():
+//     gcc -O2 -DPINO_NO_MAIN -DPINO_AOT_MAIN pino.c out.c -o prog
+bool emit_c (const char* path)
+{
+    FILE* out;
+    word_header** words;
+    body_op* ops;
+    bool* ok;
+    int count;
+    int idx;
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        out_printf("can't open %s\n", path);
+        return false;
+    }
+
+    count = collect_user_entries(&words);
+    ok = calloc(count + 1, sizeof(bool));
+    ops = malloc(MAX_BODY_OPS * sizeof(body_op));
+
+    for (idx = 0; idx < count; idx++) {
+        ok[idx] = emit_c_check(words, ok, idx, ops);
+    }
+
+    fprintf(out,
+        "// Generated by pino --emit-c\n"
+        "\n"
+        "#include <stdio.h>\n"
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "#include <stdlib.h>\n"
+        "\n"
+        "extern __thread uintptr_t data_stack[];\n"
+        "extern __thread unsigned int tods;\n"
+        "int check_stack_range(void);\n"
+        "const char* throw_message(int code);\n"
+        "\n"
+        "#define TOS         data_stack[tods]\n"
+        "#define NOS         data_stack[tods - 1]\n"
+        "#define PUSH(x)     (data_stack[++tods] = (uintptr_t)(x))\n"
+        "#define POP()       (data_stack[tods--])\n"
+        "\n");
+
+    for (idx = 0; idx < count; idx++) {
+        if (ok[idx]) {
+            fprintf(out, "void pino_w%d (void);    // %s\n", idx, words[idx]->name);
+        } else {
+            fprintf(out, "// %s: not translated\n", words[idx]->name);
+        }
+    }
+
+    for (idx = 0; idx < count; idx++) {
+        if (ok[idx]) {
+            emit_c_word(out, words, idx, ops);
+        }
+    }
+
+    fprintf(out,
+        "\n"
+        "typedef struct {\n"
+        "    const char* name;\n"
+        "    void (*fn)(void);\n"
+        "} pino_aot_word;\n"
+        "\n"
+        "const pino_aot_word pino_aot_words[] = {\n");
+
+    // Newest first, so lookups find redefinitions the same way find_word does.
+    for (idx = count - 1; idx >= 0; idx--) {
+        if (ok[idx]) {
+            fprintf(out, "    {");
+            emit_c_string(out, words[idx]->name);
+            fprintf(out, ", pino_w%d},\n", idx);
         }
     }
+
+    fprintf(out,
+        "    {NULL, NULL}\n"
+        "};\n"
+        "\n"
+        "#ifdef PINO_AOT_MAIN\n"
+        "// Each argument is a number to push or a word to run.\n"
+        "int main (int argc, char** argv)\n"
+        "{\n"
+        "    int arg;\n"
+        "\n"
+        "    tods = %d;\n"
+        "\n"
+        "    for (arg = 1; arg < argc; arg++) {\n"
+        "        const pino_aot_word* w;\n"
+        "        char* end;\n"
+        "        long num = strtol(argv[arg], &end, 10);\n"
+        "\n"
+        "        for (w = pino_aot_words; w->name != NULL; w++) {\n"
+        "            if (!strncmp(argv[arg], w->name, 7)) {\n"
+        "                break;\n"
+        "            }\n"
+        "        }\n"
+        "\n"
+        "        if (w->name != NULL) {\n"
+        "            int err;\n"
+        "\n"
+        "            w->fn();\n"
+        "            err = check_stack_range();\n"
+        "            if (err != 0) {\n"
+        "                printf(\"%%s\\n\", throw_message(err));\n"
+        "                return 1;\n"
+        "            }\n"
+        "        } else if (*end == '\\0' && end != argv[arg]) {\n"
+        "            PUSH((intptr_t)num);\n"
+        "        } else {\n"
+        "            printf(\"%%s?\\n\", argv[arg]);\n"
+        "            return 1;\n"
+        "        }\n"
+        "    }\n"
+        "\n"
+        "    while (tods > %d) {\n"
+        "        printf(\"%%d \", (int)POP());\n"
+        "    }\n"
+        "    printf(\"\\n\");\n"
+        "\n"
+        "    return 0;\n"
+        "}\n"
+        "#endif\n",
+        BASE_OF_STACK, BASE_OF_STACK);
+
+    free(ops);
+    free(ok);
+    free(words);
+    fclose(out);
+
+    return true;
 }
 
 
-int main (void)
+#ifndef PINO_NO_MAIN
+int main (int argc, char** argv)
 {
+    const char* emit_c_path = NULL;
+    const char* profile_out = NULL;
+    bool perf_map = false;
+    bool jitdump = false;
+    int arg;
+
+    out_is_tty = isatty(STDOUT_FILENO);
+    atexit(out_flush);
+
+    for (arg = 1; arg < argc; arg++) {
+        if (!strcmp(argv[arg], "-v")) {
+            verbosity++;
+        } else if (!strcmp(argv[arg], "-q")) {
+            verbosity = 0;
+        } else if (!strcmp(argv[arg], "--emit-c") && arg + 1 < argc) {
+            emit_c_path = argv[++arg];
+        } else if (!strcmp(argv[arg], "--perf-counters")) {
+            if (!perf_counters_init()) {
+                return 1;
+            }
+        } else if (!strcmp(argv[arg], "--tier-threshold") && arg + 1 < argc) {
+            tier_threshold = strtoul(argv[++arg], NULL, 0);
+        } else if (!strcmp(argv[arg], "--profile-out") && arg + 1 < argc) {
+            profile_out = argv[++arg];
+            branch_profiling = true;
+        } else if (!strcmp(argv[arg], "--use-profile") && arg + 1 < argc) {
+            if (!pgo_read(argv[++arg])) {
+                return 1;
+            }
+        } else if (!strcmp(argv[arg], "--perf-map")) {
+            perf_map = true;
+        } else if (!strcmp(argv[arg], "--jitdump")) {
+            perf_map = true;
+            jitdump = true;
+        } else {
+            out_printf("usage: %s [-v] [-q] [--emit-c out.c] [--perf-counters] [--perf-map] [--jitdump]"
+                   " [--tier-threshold N] [--profile-out file] [--use-profile file]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
     // Init machine
     memset(return_stack, 0, sizeof(return_stack));
     tors = BASE_OF_STACK;
     tods = BASE_OF_STACK;
     input_buffer[0] = '\0';
-    entry = dictionary + LAST_ENTRY_IDX * sizeof(native_fword);
-    here = entry + sizeof(native_fword);
+    entry = NULL;
+    here = code_arena;
     compile_mode = false;
 
+    // Branch counts must map back to the bodies as they were defined.
+    if (branch_profiling) {
+        tier_threshold = 0;
+    }
+
+    init_vector_ops();
+    create_native_entries();
     create_user_entries();
 
+    if (perf_map) {
+        if (!perf_map_init(jitdump)) {
+            return 1;
+        }
+        perf_map_existing();
+    }
+
     repl();
 
+    if (profile_out != NULL && !pgo_write(profile_out)) {
+        return 1;
+    }
+
+    if (emit_c_path != NULL && !emit_c(emit_c_path)) {
+        return 1;
+    }
 
     return 0;
 }
+#endif
 
 
 
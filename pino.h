@@ -0,0 +1,67 @@
+// Native word plugin interface for pino
+//
+// A plugin is a shared object exporting pino_plugin_init().  The
+// load-native word dlopen()s it and calls pino_plugin_init(), which links
+// its primitives into the dictionary with pino_register().
+//
+// Primitives follow the same contract as the built-in atoms: do the work
+// on the stacks, then return next() so the inner loop keeps running.  They
+// must not take inline operands from the threaded code.  To raise an
+// error, return pino_throw() with a nonzero code instead; the newest
+// catch gets it, or the REPL reports it and recovers.
+//
+//     void* my_square (void)
+//     {
+//         intptr_t v = pino_pop();
+//         pino_push(v * v);
+//         return next();
+//     }
+//
+//     void pino_plugin_init (void)
+//     {
+//         pino_register("square", my_square, 0);
+//     }
+//
+// Build with: gcc -shared -fPIC -o square.so square.c
+//
+// Function cells share the threaded code with user word cells, which are
+// tagged with bit 0, so pino_register() refuses a primitive at an odd
+// address.  Including this header aligns the plugin's functions; code
+// that doesn't include it needs -falign-functions=16.
+
+#ifndef PINO_H
+#define PINO_H
+
+#pragma GCC optimize ("align-functions=16")
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef    void*(*fword)(void);
+
+// Flags for pino_register()
+#define PINO_IMMEDIATE      0x04
+
+// Per thread, so primitives also work in par-map workers.
+extern __thread fword* i_ptr;
+extern __thread uintptr_t data_stack[];
+extern __thread unsigned int tods;
+
+void* next (void);
+void* pino_throw (int code);
+bool pino_register (const char* name, fword fn, uint8_t flags);
+
+// The plugin entry point.
+void pino_plugin_init (void);
+
+static inline void pino_push (intptr_t v)
+{
+    data_stack[++tods] = v;
+}
+
+static inline intptr_t pino_pop (void)
+{
+    return data_stack[tods--];
+}
+
+#endif